@@ -55,30 +55,27 @@ class Custom : public Melted
 			return new Response( 400, "Invalid" );
 		}
 
-		// Custom command execution
-		Response *execute( char *command )
+		// Custom command - called for the DEBUG command registered in main
+		Response *command( char * )
 		{
-			Response *response = NULL;
-
-			if ( !strcmp( command, "debug" ) )
+			Response *response = new Response( 200, "Diagnostics output" );
+			for( int i = 0; unit( i ) != NULL; i ++ )
 			{
-				// Example of a custom command 
-				response = new Response( 200, "Diagnostics output" );
-				for( int i = 0; unit( i ) != NULL; i ++ )
-				{
-					Properties *properties = unit( i );
-					stringstream output;
-					output << string( "Unit " ) << i << endl;
-					for ( int j = 0; j < properties->count( ); j ++ )
-						output << properties->get_name( j ) << " = " << properties->get( j ) << endl;
-					response->write( output.str( ).c_str( ) );
-				}
-			}
-			else
-			{
-				// Use the default command processing
-				response = Melted::execute( command );
+				Properties *properties = unit( i );
+				stringstream output;
+				output << string( "Unit " ) << i << endl;
+				for ( int j = 0; j < properties->count( ); j ++ )
+					output << properties->get_name( j ) << " = " << properties->get( j ) << endl;
+				response->write( output.str( ).c_str( ) );
 			}
+			return response;
+		}
+
+		// Command execution
+		Response *execute( char *command )
+		{
+			// Use the default command processing
+			Response *response = Melted::execute( command );
 
 			// If no event exists and the first unit has been added...
 			if ( event == NULL && unit( 0 ) != NULL )
@@ -127,6 +124,7 @@ class Custom : public Melted
 int main( int, char** )
 {
 	Custom server( "Server" );
+	server.add_command( "DEBUG", "Output the properties of each unit." );
 	server.start( );
 	server.execute( "uadd sdl" );
 	server.execute( "play u0" );
@@ -21,6 +21,7 @@
 #include "MltMelted.h"
 #include "MltService.h"
 #include "MltResponse.h"
+#include <melted/melted_local.h>
 using namespace Mlt;
 
 #include <time.h>
@@ -84,6 +85,19 @@ static mvcp_response mlt_melted_push( void *arg, char *command, mlt_service serv
 	}
 }
 
+static mvcp_response mlt_melted_command( void *arg, char *command )
+{
+	Melted *melted = ( Melted * )arg;
+	Response *response = melted->command( command );
+	if ( response != NULL )
+	{
+		mvcp_response real = mvcp_response_clone( response->get_response( ) );
+		delete response;
+		return real;
+	}
+	return NULL;
+}
+
 Melted::Melted( char *name, int port, char *config ) :
 	Properties( false )
 {
@@ -94,6 +108,7 @@ Melted::Melted( char *name, int port, char *config ) :
 
 Melted::~Melted( )
 {
+	melted_local_unregister_commands( this );
 	melted_server_close( server );
 }
 
@@ -138,6 +153,16 @@ Response *Melted::push( char *command, Service *service )
 	return new Response( _push( _real, command, service->get_service( ) ) );
 }
 
+bool Melted::add_command( const char *name, const char *help )
+{
+	return melted_local_register_command( name, mlt_melted_command, this, help ) == 0;
+}
+
+Response *Melted::command( char * )
+{
+	return new Response( 400, "Unknown command" );
+}
+
 void Melted::wait_for_shutdown( )
 {
 	struct timespec tm = { 1, 0 };
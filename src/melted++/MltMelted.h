@@ -48,6 +48,8 @@ namespace Mlt
 			virtual Response *execute( char *command );
 			virtual Response *received( char *command, char *doc );
 			virtual Response *push( char *command, Service *service );
+			bool add_command( const char *name, const char *help = NULL );
+			virtual Response *command( char *command );
 			void wait_for_shutdown( );
 			static void log_level( int );
 			Properties *unit( int );
@@ -58,7 +58,7 @@ static void main_cleanup( )
 
 void usage( char *app )
 {
-	fprintf( stderr, "Usage: %s [-prio NNNN|max] [-test] [-port NNNN] [-c config-file]\n", app );
+	fprintf( stderr, "Usage: %s [-prio NNNN|max] [-test] [-port NNNN] [-reactor N] [-c config-file]\n", app );
 	exit( 0 );
 }
 
@@ -72,7 +72,7 @@ int main( int argc, char **argv )
 	int background = 1;
 	int test = 0;
 	struct timespec tm = { 1, 0 };
-	mvcp_status_t status;
+	mvcp_status_record_t status;
 	struct {
 		int clip_index;
 		int is_logged;
@@ -107,6 +107,8 @@ int main( int argc, char **argv )
 	{
 		if ( !strcmp( argv[ index ], "-port" ) )
 			melted_server_set_port( server, atoi( argv[ ++ index ] ) );
+		else if ( !strcmp( argv[ index ], "-reactor" ) )
+			melted_server_set_io_threads( server, atoi( argv[ ++ index ] ) );
 		else if ( !strcmp( argv[ index ], "-proxy" ) )
 			melted_server_set_proxy( server, argv[ ++ index ] );
 		else if ( !strcmp( argv[ index ], "-test" ) )
@@ -152,6 +154,7 @@ int main( int argc, char **argv )
 	error = melted_server_execute( server );
 
 	/* Initialize the as-run log tracking */
+	memset( &status, 0, sizeof( status ) );
 	for ( index = 0; index < MAX_UNITS; index ++ )
 		asrun[ index ].clip_index = -1;
 
@@ -161,11 +164,11 @@ int main( int argc, char **argv )
 		nanosleep( &tm, NULL );
 
 		/* As-run logging */
-		for ( index = 0; !error && index < MAX_UNITS; index ++ )
+		for ( index = 0; !error && index < melted_get_unit_count( ); index ++ )
 		{
 			melted_unit unit = melted_get_unit( index );
 
-			if ( unit && melted_unit_get_status( unit, &status ) == 0 )
+			if ( unit && melted_unit_get_status_record( unit, &status ) == 0 )
 			{
 				int length = status.length - 60;
 
@@ -178,12 +181,14 @@ int main( int argc, char **argv )
 				/* Log as-run only once when near the end */
 				if ( ! asrun[ index ].is_logged && status.length > 0 && status.position > length )
 				{
-					melted_log( LOG_NOTICE, "AS-RUN U%d \"%s\" len %d pos %d", index, status.clip, status.length, status.position );
+					melted_log( LOG_NOTICE, "AS-RUN U%d \"%s\" len %d pos %d", index, mvcp_title_text( status.clip ), status.length, status.position );
 					asrun[ index ].is_logged = 1;
 				}
 			}
 		}
 	}
 
+	mvcp_status_record_clear( &status );
+
 	return error;
 }
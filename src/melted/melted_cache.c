@@ -0,0 +1,347 @@
+/*
+ * melted_cache.c -- Producer Cache
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Application header files */
+#include "melted_cache.h"
+#include "melted_log.h"
+
+/** A profile owned by the cache - cached producers are opened with these
+	rather than a unit's profile, as cuts of them may outlive the unit.
+	They are only released with the process.
+*/
+
+typedef struct melted_cache_profile_s
+{
+	mlt_profile profile;
+	struct melted_cache_profile_s *next;
+}
+*melted_cache_profile;
+
+/** An open producer. Cuts of a producer share its decoder, so an entry
+	only serves the unit which opened it.
+*/
+
+typedef struct melted_cache_entry_s
+{
+	int unit;
+	char *key;
+	time_t mtime;
+	mlt_profile profile;
+	mlt_producer producer;
+	struct melted_cache_entry_s *prev;
+	struct melted_cache_entry_s *next;
+}
+*melted_cache_entry, melted_cache_entry_t;
+
+/** The cache - entries are kept most recently used first.
+*/
+
+static struct
+{
+	pthread_mutex_t mutex;
+	melted_cache_profile profiles;
+	melted_cache_entry head;
+	melted_cache_entry tail;
+	melted_cache_stats_t stats;
+}
+cache = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL, { 0, 0, 0, MELTED_CACHE_SIZE } };
+
+/** Find or create the cache's copy of a profile - must be called with the
+	mutex held.
+*/
+
+static mlt_profile melted_cache_profile_get( mlt_profile profile )
+{
+	melted_cache_profile entry = NULL;
+
+	for ( entry = cache.profiles; entry != NULL; entry = entry->next )
+	{
+		mlt_profile other = entry->profile;
+		if ( other->width == profile->width && other->height == profile->height &&
+			 other->frame_rate_num == profile->frame_rate_num && other->frame_rate_den == profile->frame_rate_den &&
+			 other->progressive == profile->progressive && other->colorspace == profile->colorspace &&
+			 other->sample_aspect_num == profile->sample_aspect_num && other->sample_aspect_den == profile->sample_aspect_den &&
+			 other->display_aspect_num == profile->display_aspect_num && other->display_aspect_den == profile->display_aspect_den )
+			return other;
+	}
+
+	entry = calloc( 1, sizeof( *entry ) );
+	if ( entry != NULL && ( entry->profile = mlt_profile_clone( profile ) ) != NULL )
+	{
+		entry->next = cache.profiles;
+		cache.profiles = entry;
+		return entry->profile;
+	}
+
+	free( entry );
+	return NULL;
+}
+
+/** Resolve a resource to its cache key - the service prefix, if any, and the
+	real path of the file. Resources which aren't regular files aren't cached.
+*/
+
+static char *melted_cache_key( char *resource, time_t *mtime )
+{
+	char path[ PATH_MAX ];
+	char *file = resource;
+	char *colon = strchr( resource, ':' );
+	struct stat info;
+	char *key = NULL;
+
+	if ( colon != NULL && ( strchr( resource, '/' ) == NULL || colon < strchr( resource, '/' ) ) )
+		file = colon + 1;
+
+	if ( realpath( file, path ) != NULL && stat( path, &info ) == 0 && S_ISREG( info.st_mode ) )
+	{
+		int prefix = file - resource;
+		key = malloc( prefix + strlen( path ) + 1 );
+		if ( key != NULL )
+		{
+			memcpy( key, resource, prefix );
+			strcpy( key + prefix, path );
+		}
+		*mtime = info.st_mtime;
+	}
+
+	return key;
+}
+
+static void melted_cache_unlink( melted_cache_entry entry )
+{
+	if ( entry->prev != NULL )
+		entry->prev->next = entry->next;
+	else
+		cache.head = entry->next;
+	if ( entry->next != NULL )
+		entry->next->prev = entry->prev;
+	else
+		cache.tail = entry->prev;
+	entry->prev = entry->next = NULL;
+	cache.stats.entries --;
+}
+
+static void melted_cache_link( melted_cache_entry entry )
+{
+	entry->prev = NULL;
+	entry->next = cache.head;
+	if ( cache.head != NULL )
+		cache.head->prev = entry;
+	else
+		cache.tail = entry;
+	cache.head = entry;
+	cache.stats.entries ++;
+}
+
+/** Release an entry - cuts handed out hold their own reference to the
+	producer, so this only drops the cache's.
+*/
+
+static void melted_cache_entry_close( melted_cache_entry entry )
+{
+	mlt_producer_close( entry->producer );
+	free( entry->key );
+	free( entry );
+}
+
+/** Close the least recently used entries until the cache fits its size -
+	must be called with the mutex held. The entries are returned in a list
+	to be closed after the mutex is released.
+*/
+
+static melted_cache_entry melted_cache_trim( )
+{
+	melted_cache_entry evicted = NULL;
+
+	while ( cache.tail != NULL && cache.stats.entries > cache.stats.size )
+	{
+		melted_cache_entry entry = cache.tail;
+		melted_cache_unlink( entry );
+		entry->next = evicted;
+		evicted = entry;
+	}
+
+	return evicted;
+}
+
+static void melted_cache_release( melted_cache_entry evicted )
+{
+	while ( evicted != NULL )
+	{
+		melted_cache_entry entry = evicted;
+		evicted = entry->next;
+		melted_cache_entry_close( entry );
+	}
+}
+
+/** Find an entry - must be called with the mutex held. Entries for an older
+	version of the file are dropped.
+*/
+
+static melted_cache_entry melted_cache_find( int unit, char *key, time_t mtime, mlt_profile profile, melted_cache_entry *stale )
+{
+	melted_cache_entry entry = cache.head;
+
+	while ( entry != NULL )
+	{
+		melted_cache_entry next = entry->next;
+		if ( entry->unit == unit && !strcmp( entry->key, key ) && entry->profile == profile )
+		{
+			if ( entry->mtime == mtime )
+				return entry;
+			melted_cache_unlink( entry );
+			entry->next = *stale;
+			*stale = entry;
+		}
+		entry = next;
+	}
+
+	return NULL;
+}
+
+/** Hand out a cut of the unit's producer for the resource - the producer is
+	opened and cached when the unit doesn't already have it open. Returns NULL
+	when the resource can't be cached or opened, in which case the caller
+	should open it itself. The cut must be closed by the caller.
+*/
+
+mlt_producer melted_cache_get( int unit, mlt_profile profile, char *resource )
+{
+	time_t mtime = 0;
+	char *key = melted_cache_key( resource, &mtime );
+	melted_cache_entry entry = NULL;
+	melted_cache_entry stale = NULL;
+	melted_cache_entry evicted = NULL;
+	mlt_producer cut = NULL;
+	mlt_profile owned = NULL;
+
+	if ( key == NULL || profile == NULL || cache.stats.size <= 0 )
+	{
+		free( key );
+		return NULL;
+	}
+
+	pthread_mutex_lock( &cache.mutex );
+	owned = melted_cache_profile_get( profile );
+	entry = owned != NULL ? melted_cache_find( unit, key, mtime, owned, &stale ) : NULL;
+	if ( entry != NULL )
+	{
+		melted_cache_unlink( entry );
+		melted_cache_link( entry );
+		cut = mlt_producer_cut( entry->producer, mlt_producer_get_in( entry->producer ), mlt_producer_get_out( entry->producer ) );
+		cache.stats.hits ++;
+	}
+	pthread_mutex_unlock( &cache.mutex );
+
+	if ( cut == NULL && owned != NULL )
+	{
+		/* Opening can take a while, so it's done without the lock */
+		mlt_producer producer = mlt_factory_producer( owned, NULL, resource );
+
+		if ( producer != NULL )
+		{
+			entry = calloc( 1, sizeof( melted_cache_entry_t ) );
+
+			pthread_mutex_lock( &cache.mutex );
+			cache.stats.misses ++;
+			if ( entry != NULL && melted_cache_find( unit, key, mtime, owned, &stale ) == NULL )
+			{
+				entry->unit = unit;
+				entry->key = key;
+				entry->mtime = mtime;
+				entry->profile = owned;
+				entry->producer = producer;
+				melted_cache_link( entry );
+				key = NULL;
+				evicted = melted_cache_trim( );
+			}
+			else
+			{
+				free( entry );
+				entry = NULL;
+			}
+			cut = mlt_producer_cut( producer, mlt_producer_get_in( producer ), mlt_producer_get_out( producer ) );
+			pthread_mutex_unlock( &cache.mutex );
+
+			/* Our reference is now held by the cache entry, if there is one */
+			if ( entry == NULL )
+				mlt_producer_close( producer );
+		}
+	}
+
+	melted_cache_release( stale );
+	melted_cache_release( evicted );
+	free( key );
+
+	return cut;
+}
+
+/** Change the number of producers held open.
+*/
+
+void melted_cache_set_size( int size )
+{
+	melted_cache_entry evicted = NULL;
+
+	pthread_mutex_lock( &cache.mutex );
+	cache.stats.size = size < 0 ? 0 : size;
+	evicted = melted_cache_trim( );
+	pthread_mutex_unlock( &cache.mutex );
+
+	melted_cache_release( evicted );
+}
+
+/** Get the cache statistics.
+*/
+
+void melted_cache_stats( melted_cache_stats_t *stats )
+{
+	pthread_mutex_lock( &cache.mutex );
+	*stats = cache.stats;
+	pthread_mutex_unlock( &cache.mutex );
+}
+
+/** Close every cached producer.
+*/
+
+void melted_cache_clear( )
+{
+	melted_cache_entry evicted = NULL;
+
+	pthread_mutex_lock( &cache.mutex );
+	while ( cache.head != NULL )
+	{
+		melted_cache_entry entry = cache.head;
+		melted_cache_unlink( entry );
+		entry->next = evicted;
+		evicted = entry;
+	}
+	pthread_mutex_unlock( &cache.mutex );
+
+	melted_cache_release( evicted );
+}
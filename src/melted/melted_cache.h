@@ -0,0 +1,57 @@
+/*
+ * melted_cache.h -- Producer Cache
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_CACHE_H_
+#define _MELTED_CACHE_H_
+
+/* MLT header files */
+#include <framework/mlt.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Default number of producers held open.
+*/
+
+#define MELTED_CACHE_SIZE 64
+
+/** Cache statistics.
+*/
+
+typedef struct
+{
+	int hits;
+	int misses;
+	int entries;
+	int size;
+}
+melted_cache_stats_t;
+
+extern mlt_producer melted_cache_get( int, mlt_profile, char * );
+extern void melted_cache_set_size( int );
+extern void melted_cache_stats( melted_cache_stats_t * );
+extern void melted_cache_clear( );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
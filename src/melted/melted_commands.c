@@ -31,19 +31,44 @@
 
 #include "melted_unit.h"
 #include "melted_commands.h"
+#include "melted_loader.h"
+#include "melted_cache.h"
+#include "melted_index.h"
 #include "melted_log.h"
 
-static melted_unit g_units[MAX_UNITS] = {NULL};
+/** Number of units in a block of the unit table.
+*/
+
+#define UNIT_BLOCK 16
+
+/** The unit table - units are held in blocks which never move once they are
+	allocated, so units are found without locking while others are added.
+	The count is one more than the highest unit in use.
+*/
+
+static melted_unit *volatile g_units[ MAX_UNITS / UNIT_BLOCK ];
+static volatile int g_unit_count = 0;
+static pthread_mutex_t g_units_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /** Return the melted_unit given a numeric index.
 */
 
 melted_unit melted_get_unit( int n )
 {
-	if (n < MAX_UNITS)
-		return g_units[n];
-	else
-		return NULL;
+	if ( n >= 0 && n < g_unit_count )
+	{
+		melted_unit *block = g_units[ n / UNIT_BLOCK ];
+		return block != NULL ? block[ n % UNIT_BLOCK ] : NULL;
+	}
+	return NULL;
+}
+
+/** Return one more than the highest unit in use.
+*/
+
+int melted_get_unit_count( void )
+{
+	return g_unit_count;
 }
 
 /** Destroy the melted_unit given its numeric index.
@@ -51,15 +76,23 @@ melted_unit melted_get_unit( int n )
 
 void melted_delete_unit( int n )
 {
-	if (n < MAX_UNITS)
+	melted_unit unit = NULL;
+
+	pthread_mutex_lock( &g_units_mutex );
+	unit = melted_get_unit( n );
+	if ( unit != NULL )
 	{
-		melted_unit unit = melted_get_unit(n);
-		if (unit != NULL)
-		{
-			melted_unit_close( unit );
-			g_units[ n ] = NULL;
-			melted_log( LOG_NOTICE, "Deleted unit U%d.", n ); 
-		}
+		g_units[ n / UNIT_BLOCK ][ n % UNIT_BLOCK ] = NULL;
+		while ( g_unit_count > 0 && melted_get_unit( g_unit_count - 1 ) == NULL )
+			g_unit_count --;
+	}
+	pthread_mutex_unlock( &g_units_mutex );
+
+	if ( unit != NULL )
+	{
+		melted_loader_cancel( unit );
+		melted_unit_close( unit );
+		melted_log( LOG_NOTICE, "Deleted unit U%d.", n ); 
 	}
 }
 
@@ -69,8 +102,11 @@ void melted_delete_unit( int n )
 void melted_delete_all_units( void )
 {
 	int i;
-	for (i = 0; i < MAX_UNITS; i++)
+	for ( i = melted_get_unit_count( ) - 1; i >= 0; i-- )
 		melted_delete_unit( i );
+	melted_loader_close( );
+	melted_cache_clear( );
+	melted_index_close( );
 }
 
 /** Add a virtual vtr to the server.
@@ -78,31 +114,40 @@ void melted_delete_all_units( void )
 response_codes melted_add_unit( command_argument cmd_arg )
 {
 	int i = 0;
+	melted_unit unit = NULL;
 
-	// Initialize g_units array on first call.
-	if ( g_units[0] == NULL )
-	{
-		for ( i = 1; i < MAX_UNITS; i ++ )
-			g_units[ i ] = NULL;
-	}
+	pthread_mutex_lock( &g_units_mutex );
 
-	// Locate first empty item in g_units array.
-	for ( i = 0; i < MAX_UNITS; i ++ )
-		if ( g_units[ i ] == NULL )
+	// Locate first empty item in the unit table.
+	for ( i = 0; i < g_unit_count; i ++ )
+		if ( melted_get_unit( i ) == NULL )
 			break;
 
-	if ( i < MAX_UNITS )
+	if ( i < MAX_UNITS && g_units[ i / UNIT_BLOCK ] == NULL )
+		g_units[ i / UNIT_BLOCK ] = calloc( UNIT_BLOCK, sizeof( melted_unit ) );
+
+	if ( i < MAX_UNITS && g_units[ i / UNIT_BLOCK ] != NULL )
 	{
 		// Add unit.
 		char *arg = cmd_arg->argument;
-		g_units[ i ] = melted_unit_init( i, arg );
-		if ( g_units[ i ] != NULL )
+		unit = melted_unit_init( i, arg );
+		if ( unit != NULL )
+		{
+			g_units[ i / UNIT_BLOCK ][ i % UNIT_BLOCK ] = unit;
+			__sync_synchronize( );
+			if ( i >= g_unit_count )
+				g_unit_count = i + 1;
+		}
+		pthread_mutex_unlock( &g_units_mutex );
+
+		if ( unit != NULL )
 		{
-			melted_unit_set_notifier( g_units[ i ], mvcp_parser_get_notifier( cmd_arg->parser ), cmd_arg->root_dir );
+			melted_unit_set_notifier( unit, mvcp_parser_get_notifier( cmd_arg->parser ), cmd_arg->root_dir );
 			mvcp_response_printf( cmd_arg->response, 10, "U%1d\n\n", i );
 		}
-		return g_units[ i ] != NULL ? RESPONSE_SUCCESS_N : RESPONSE_ERROR;
+		return unit != NULL ? RESPONSE_SUCCESS_N : RESPONSE_ERROR;
 	}
+	pthread_mutex_unlock( &g_units_mutex );
 	mvcp_response_printf( cmd_arg->response, 1024, "no more units can be created\n\n" );
 
 	return RESPONSE_ERROR;
@@ -125,7 +170,7 @@ response_codes melted_list_units( command_argument cmd_arg )
 	response_codes error = RESPONSE_SUCCESS_N;
 	int i = 0;
 
-	for ( i = 0; i < MAX_UNITS; i ++ )
+	for ( i = 0; i < melted_get_unit_count( ); i ++ )
 	{
 		melted_unit unit = melted_get_unit( i );
 		if ( unit != NULL )
@@ -142,49 +187,62 @@ response_codes melted_list_units( command_argument cmd_arg )
 	return error;
 }
 
-static int filter_files( const struct dirent *de )
-{
-	return de->d_name[ 0 ] != '.';
-}
-
-/** List clips in a directory.
+/** List clips in a directory - offset=n and limit=n page through the list,
+	match=glob filters it and sort=name, size or mtime (preceded by - for
+	descending order) orders it.
 */
 response_codes melted_list_clips( command_argument cmd_arg )
 {
-	response_codes error = RESPONSE_BAD_FILE;
 	const char *dir_name = (const char*) cmd_arg->argument;
-	DIR *dir;
 	char fullname[1024];
-	struct dirent **de = NULL;
-	int i, n;
-	
-	snprintf( fullname, 1023, "%s%s", cmd_arg->root_dir, dir_name );
-	dir = opendir( fullname );
-	if (dir != NULL)
+	melted_index_query_t query;
+	int i;
+
+	memset( &query, 0, sizeof( query ) );
+	query.limit = -1;
+
+	for ( i = 2; i < mvcp_tokeniser_count( cmd_arg->tokeniser ); i ++ )
 	{
-		struct stat info;
-		error = RESPONSE_SUCCESS_N;
-		n = scandir( fullname, &de, filter_files, alphasort );
-		for (i = 0; i < n; i++ )
+		char *option = mvcp_tokeniser_get_string( cmd_arg->tokeniser, i );
+		if ( !strncasecmp( option, "offset=", 7 ) )
+			query.offset = atoi( option + 7 );
+		else if ( !strncasecmp( option, "limit=", 6 ) )
+			query.limit = atoi( option + 6 );
+		else if ( !strncasecmp( option, "match=", 6 ) )
 		{
-			snprintf( fullname, 1023, "%s%s/%s", cmd_arg->root_dir, dir_name, de[i]->d_name );
-			if ( stat( fullname, &info ) == 0 && S_ISDIR( info.st_mode ) )
-				mvcp_response_printf( cmd_arg->response, 1024, "\"%s/\"\n", de[i]->d_name );
+			// The closing quote of match="..." has already been stripped
+			char *match = option + 6;
+			if ( match[ 0 ] == '\"' )
+				match ++;
+			query.match = match;
 		}
-		for (i = 0; i < n; i++ )
+		else if ( !strncasecmp( option, "sort=", 5 ) )
 		{
-			snprintf( fullname, 1023, "%s%s/%s", cmd_arg->root_dir, dir_name, de[i]->d_name );
-			if ( lstat( fullname, &info ) == 0 && 
-				 ( S_ISREG( info.st_mode ) || S_ISLNK( info.st_mode ) || ( strstr( fullname, ".clip" ) && info.st_mode | S_IXUSR ) ) )
-				mvcp_response_printf( cmd_arg->response, 1024, "\"%s\" %llu\n", de[i]->d_name, (unsigned long long) info.st_size );
-			free( de[ i ] );
+			char *order = option + 5;
+			query.descending = order[ 0 ] == '-';
+			if ( order[ 0 ] == '-' || order[ 0 ] == '+' )
+				order ++;
+			if ( !strcasecmp( order, "name" ) )
+				query.order = melted_index_by_name;
+			else if ( !strcasecmp( order, "size" ) )
+				query.order = melted_index_by_size;
+			else if ( !strcasecmp( order, "mtime" ) )
+				query.order = melted_index_by_mtime;
+			else
+				return RESPONSE_OUT_OF_RANGE;
 		}
-		free( de );
-		closedir( dir );
-		mvcp_response_write( cmd_arg->response, "\n", 1 );
+		else
+			return RESPONSE_OUT_OF_RANGE;
 	}
+	if ( query.offset < 0 )
+		return RESPONSE_OUT_OF_RANGE;
 
-	return error;
+	snprintf( fullname, 1023, "%s%s", cmd_arg->root_dir, dir_name );
+	if ( melted_index_list( fullname, &query, cmd_arg->response ) != 0 )
+		return RESPONSE_BAD_FILE;
+	mvcp_response_write( cmd_arg->response, "\n", 1 );
+
+	return RESPONSE_SUCCESS_N;
 }
 
 /** Set a server configuration property.
@@ -208,10 +266,10 @@ response_codes melted_set_global_property( command_argument cmd_arg )
 		int i;
 		
 		/* stop all units and unload clips */
-		for (i = 0; i < MAX_UNITS; i++)
+		for (i = 0; i < melted_get_unit_count( ); i++)
 		{
-			if (g_units[i] != NULL)
-				melted_unit_terminate( g_units[i] );
+			if (melted_get_unit( i ) != NULL)
+				melted_unit_terminate( melted_get_unit( i ) );
 		}
 
 		/* set the property */
@@ -248,4 +306,32 @@ response_codes melted_get_global_property( command_argument cmd_arg )
 	return RESPONSE_SUCCESS;
 }
 
+/** Report the producer cache statistics - CACHE CLEAR closes the cached
+	producers and CACHE SIZE n changes the number held open.
+*/
+
+response_codes melted_cache( command_argument cmd_arg )
+{
+	int count = mvcp_tokeniser_count( cmd_arg->tokeniser );
+	melted_cache_stats_t stats;
+
+	if ( count > 1 )
+	{
+		char *action = mvcp_tokeniser_get_string( cmd_arg->tokeniser, 1 );
+		if ( !strcasecmp( action, "CLEAR" ) && count == 2 )
+			melted_cache_clear( );
+		else if ( !strcasecmp( action, "SIZE" ) && count == 3 )
+			melted_cache_set_size( atoi( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ) ) );
+		else
+			return RESPONSE_OUT_OF_RANGE;
+	}
+
+	melted_cache_stats( &stats );
+	mvcp_response_printf( cmd_arg->response, 1024, "hits %d\n", stats.hits );
+	mvcp_response_printf( cmd_arg->response, 1024, "misses %d\n", stats.misses );
+	mvcp_response_printf( cmd_arg->response, 1024, "entries %d\n", stats.entries );
+	mvcp_response_printf( cmd_arg->response, 1024, "size %d\n", stats.size );
+	mvcp_response_printf( cmd_arg->response, 1024, "\n" );
 
+	return RESPONSE_SUCCESS_N;
+}
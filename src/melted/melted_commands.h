@@ -32,6 +32,7 @@ extern "C"
 #endif
 
 extern melted_unit melted_get_unit( int );
+extern int melted_get_unit_count( void );
 extern void melted_delete_unit( int );
 extern void melted_delete_all_units( void );
 //extern void raw1394_start_service_threads( void );
@@ -43,6 +44,7 @@ extern response_codes melted_list_units( command_argument );
 extern response_codes melted_list_clips( command_argument );
 extern response_codes melted_set_global_property( command_argument );
 extern response_codes melted_get_global_property( command_argument );
+extern response_codes melted_cache( command_argument );
 
 #ifdef __cplusplus
 }
@@ -32,9 +32,18 @@
 #include <time.h>
 #include <netdb.h>
 #include <sys/socket.h> 
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include <mvcp/mvcp_socket.h>
+#include <mvcp/mvcp_reader.h>
+#include <mvcp/mvcp_tokeniser.h>
 
 /* Application header files */
 #include "melted_commands.h"
@@ -42,47 +51,30 @@
 #include "melted_server.h"
 #include "melted_log.h"
 
-/** This is a generic replacement for fgets which operates on a file
-   descriptor. Unlike fgets, we can also specify a line terminator. Maximum
-   of (max - 1) chars can be read into buf from fd. If we reach the
-   end-of-file, *eof_chk is set to 1. 
+/** Maximum number of pieces gathered into a single writev.
 */
 
-int fdgetline( int fd, char *buf, int max, char line_terminator, int *eof_chk )
-{
-	int count = 0;
-	char tmp [1];
-	*eof_chk = 0;
-	
-	if (fd)
-		while (count < max - 1) {
-			if (read (fd, tmp, 1) > 0) {
-				if (tmp [0] != line_terminator)
-					buf [count++] = tmp [0];
-				else
-					break;
+#ifdef IOV_MAX
+#define CONNECTION_IOV ( IOV_MAX < 1024 ? IOV_MAX : 1024 )
+#else
+#define CONNECTION_IOV 16
+#endif
 
-/* Is it an EOF character (ctrl-D, i.e. ascii 4)? If so we definitely want
-   to break. */
+/** Pieces of a response waiting to be written.
+*/
 
-				if (tmp [0] == 4) {
-					*eof_chk = 1;
-					break;
-				}
-			} else {
-				*eof_chk = 1;
-				break;
-			}
-		}
-		
-	buf [count] = '\0';
-	
-	return count;
+typedef struct
+{
+	int fd;
+	int count;
+	int corked;
+	struct iovec iov[ CONNECTION_IOV ];
 }
+connection_gather;
 
 static int connection_initiate( int );
 static int connection_send( int, mvcp_response );
-static int connection_read( int, char *, int );
+static int connection_read( mvcp_reader, char *, int );
 static void connection_close( int );
 
 static int connection_initiate( int fd )
@@ -95,7 +87,13 @@ static int connection_initiate( int fd )
 	return error;
 }
 
-static int connection_send( int fd, mvcp_response response )
+/** Emit the wire form of a response through the emitter provided.
+
+	The response code is normalised first (a 200 with a body becomes a 201 or
+	202) and multi-line responses receive their terminating blank line. 
+*/
+
+int connection_format( mvcp_response response, connection_emitter emit, void *arg )
 {
 	int error = 0;
 	int index = 0;
@@ -119,33 +117,114 @@ static int connection_send( int fd, mvcp_response response )
 		for ( index = 0; !error && index < items; index ++ )
 		{
 			char *line = mvcp_response_get_line( response, index );
-			int length = strlen( line );
-			if ( length == 0 && index != mvcp_response_count( response ) - 1 && write( fd, " ", 1 ) != 1 )
+			int length = mvcp_response_get_length( response, index );
+			if ( length == 0 && index != mvcp_response_count( response ) - 1 && emit( arg, " ", 1 ) )
+				error = -1;
+			else if ( length > 0 && emit( arg, line, length ) )
 				error = -1;
-			else if ( length > 0 && write( fd, line, length ) != length )
+			if ( emit( arg, "\r\n", 2 ) )
 				error = -1;
-			if ( write( fd, "\r\n", 2 ) != 2 )
-				error = -1;			
 		}
 
-		if ( ( code == 201 || code == 500 ) && strcmp( mvcp_response_get_line( response, items - 1 ), "" ) )
-			if ( write( fd, "\r\n", 2 ) != 2 )
+		if ( ( code == 201 || code == 500 ) && mvcp_response_get_length( response, items - 1 ) > 0 )
+			if ( emit( arg, "\r\n", 2 ) )
 				melted_log( LOG_ERR, "write(\"\\r\\n\") failed!" );
 	}
 	else
 	{
 		const char *message = "500 Empty Response\r\n\r\n";
-		if ( write( fd, message, strlen( message ) ) != strlen( message ))
+		if ( emit( arg, message, strlen( message ) ) )
 			melted_log( LOG_ERR, "write(%s) failed!", message );
 	}
 
 	return error;
 }
 
-static int connection_read( int fd, char *command, int length )
+/** Set or clear TCP_CORK so that a response spanning several writev calls
+	still leaves in full segments.
+*/
+
+static void connection_cork( int fd, int on )
+{
+#ifdef TCP_CORK
+	setsockopt( fd, IPPROTO_TCP, TCP_CORK, &on, sizeof( on ) );
+#endif
+}
+
+/** Write all the gathered pieces.
+*/
+
+static int connection_flush( connection_gather *gather )
+{
+	struct iovec *iov = gather->iov;
+	int count = gather->count;
+
+	while ( count > 0 )
+	{
+		ssize_t written = writev( gather->fd, iov, count );
+		if ( written < 0 && errno == EINTR )
+			continue;
+		if ( written <= 0 )
+			return -1;
+		while ( count > 0 && written >= iov->iov_len )
+		{
+			written -= iov->iov_len;
+			iov ++;
+			count --;
+		}
+		if ( count > 0 )
+		{
+			iov->iov_base = ( char * )iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	gather->count = 0;
+	return 0;
+}
+
+/** Emitter which gathers the pieces of a response - the data must remain
+	valid until the gather is flushed.
+*/
+
+static int connection_write( void *arg, const char *data, int length )
+{
+	connection_gather *gather = arg;
+	if ( gather->count == CONNECTION_IOV )
+	{
+		if ( !gather->corked )
+			connection_cork( gather->fd, gather->corked = 1 );
+		if ( connection_flush( gather ) )
+			return -1;
+	}
+	gather->iov[ gather->count ].iov_base = ( void * )data;
+	gather->iov[ gather->count ].iov_len = length;
+	gather->count ++;
+	return 0;
+}
+
+static int connection_send( int fd, mvcp_response response )
+{
+	connection_gather gather;
+	int error = 0;
+
+	gather.fd = fd;
+	gather.count = 0;
+	gather.corked = 0;
+
+	error = connection_format( response, connection_write, &gather );
+	if ( connection_flush( &gather ) )
+		error = -1;
+	if ( gather.corked )
+		connection_cork( fd, 0 );
+
+	return error;
+}
+
+static int connection_read( mvcp_reader reader, char *command, int length )
 {
 	int eof_chk;
-	int nchars = fdgetline( fd, command, length, '\n', &eof_chk );
+	int nchars = mvcp_reader_get_line( reader, command, length, &eof_chk );
 	char *cr = strchr( command, '\r');
 	if ( cr != NULL ) 
 		cr[0] = '\0';
@@ -154,46 +233,725 @@ static int connection_read( int fd, char *command, int length )
 	return nchars;
 }
 
-int connection_status( int fd, mvcp_notifier notifier )
+/** Determine the printable address of the connected client.
+*/
+
+void connection_resolve( connection_t *connection, int numeric )
+{
+	struct hostent *he = NULL;
+
+	/* Reverse lookups block, so callers which can't afford that ask for the numeric form */
+	if ( !numeric )
+		he = gethostbyaddr( (char *) &( connection->sin.sin_addr.s_addr ), sizeof(u_int32_t), AF_INET); 
+	if ( he != NULL )
+		snprintf( connection->address, sizeof( connection->address ), "%s", he->h_name );
+	else
+		inet_ntop( AF_INET, &( connection->sin.sin_addr.s_addr), connection->address, 32 );
+}
+
+/** Execute a single command line received on the connection.
+*/
+
+mvcp_response connection_execute( connection_t *connection, char *command )
+{
+	mvcp_response response = NULL;
+	mlt_events_fire( connection->owner, "command-received", &response, command, NULL );
+	if ( response == NULL )
+		response = mvcp_parser_execute( connection->parser, command );
+	melted_log( LOG_INFO, "%s \"%s\" %d", connection->address, command, mvcp_response_get_error_code( response ) );
+	return response;
+}
+
+/** Load a document with the xml producer given and hand it to the parser.
+*/
+
+static mvcp_response connection_push_xml( connection_t *connection, char *command, const char *id, char *resource )
+{
+	mvcp_response response = NULL;
+	mlt_profile profile = mlt_profile_init( NULL );
+	mlt_service service = NULL;
+
+	profile->is_explicit = 1;
+	service = ( mlt_service )mlt_factory_producer( profile, id, resource );
+	if ( service )
+	{
+		mlt_properties_set_data( MLT_SERVICE_PROPERTIES( service ), "melted_profile", profile,
+			0, (mlt_destructor) mlt_profile_close, NULL );
+		mlt_events_fire( connection->owner, "push-received", &response, command, service, NULL );
+		if ( response == NULL )
+			response = mvcp_parser_push( connection->parser, command, service );
+	}
+	else
+	{
+		mlt_profile_close( profile );
+		response = mvcp_response_init();
+		mvcp_response_set_error( response, RESPONSE_BAD_FILE, "Failed to load XML" );
+	}
+	mlt_service_close( service );
+	return response;
+}
+
+/** Handle the body of a PUSH or BATCH command once it has been received in
+	full.
+
+	The buffer must be NUL terminated at bytes. A NULL response is returned
+	when nothing was received.
+*/
+
+mvcp_response connection_push( connection_t *connection, char *command, char *buffer, int bytes )
 {
+	mlt_properties owner = connection->owner;
+	mvcp_parser parser = connection->parser;
+	mvcp_response response = NULL;
+
+	if ( bytes > 0 )
+	{
+		if ( !strncmp( command, "BATCH ", 6 ) )
+			response = mvcp_parser_received( parser, command, buffer );
+		else if ( mlt_properties_get( owner, "push-parser-off" ) == 0 )
+			response = connection_push_xml( connection, command, "xml-string", buffer );
+		else
+			response = mvcp_parser_received( parser, command, buffer );
+	}
+	melted_log( LOG_INFO, "%s \"%s\" %d", connection->address, command, mvcp_response_get_error_code( response ) );
+	return response;
+}
+
+/** Largest chunk accepted in a chunked body.
+*/
+
+#define CONNECTION_CHUNK_MAX ( 16 * 1024 * 1024 )
+
+/** Start spooling a chunked body. A spool which couldn't be created still
+	accepts the body (to keep the connection in step) but fails the command.
+*/
+
+void connection_spool_open( connection_spool spool )
+{
+	const char *dir = getenv( "TMPDIR" );
+
+	memset( spool, 0, sizeof( connection_spool_t ) );
+	snprintf( spool->path, sizeof( spool->path ), "%s/melted-push.XXXXXX", dir != NULL && *dir != '\0' ? dir : "/tmp" );
+	spool->fd = mkstemp( spool->path );
+	spool->error = spool->fd < 0;
+}
+
+/** Take the size line of the next chunk - the size is in hex and a size of
+	zero ends the body. Returns non-zero if the line is malformed, in which
+	case the connection can't be kept in step.
+*/
+
+int connection_spool_size( connection_spool spool, char *line )
+{
+	char *end = NULL;
+	long size = strtol( line, &end, 16 );
+	int error = end == line || *end != '\0' || size < 0 || size > CONNECTION_CHUNK_MAX || size > INT_MAX - spool->bytes;
+
+	if ( !error )
+	{
+		spool->remaining = size;
+		spool->done = size == 0;
+	}
+
+	return error;
+}
+
+/** Spool data from the current chunk.
+*/
+
+void connection_spool_write( connection_spool spool, char *data, int length )
+{
+	if ( !spool->error )
+	{
+		int written = 0;
+		while ( written < length )
+		{
+			int count = write( spool->fd, data + written, length - written );
+			if ( count < 0 && errno == EINTR )
+				continue;
+			if ( count <= 0 )
+			{
+				spool->error = 1;
+				break;
+			}
+			written += count;
+		}
+	}
+	spool->remaining -= length;
+	spool->bytes += length;
+}
+
+/** Handle a body which has been spooled in full and close the spool. A PUSH
+	is loaded from the spool by the xml producer, so the document is never
+	held in memory as a whole - anything else gets the body as a string.
+*/
+
+mvcp_response connection_push_spool( connection_t *connection, char *command, connection_spool spool )
+{
+	mvcp_response response = NULL;
+
+	if ( spool->error )
+	{
+		response = mvcp_response_init( );
+		mvcp_response_set_error( response, RESPONSE_ERROR, "Unable to spool the document" );
+		melted_log( LOG_INFO, "%s \"%s\" %d", connection->address, command, RESPONSE_ERROR );
+	}
+	else if ( spool->bytes > 0 && strncmp( command, "BATCH ", 6 ) && mlt_properties_get( connection->owner, "push-parser-off" ) == 0 )
+	{
+		response = connection_push_xml( connection, command, "xml", spool->path );
+		melted_log( LOG_INFO, "%s \"%s\" %d", connection->address, command, mvcp_response_get_error_code( response ) );
+	}
+	else
+	{
+		char *buffer = malloc( spool->bytes + 1 );
+		if ( buffer != NULL && pread( spool->fd, buffer, spool->bytes, 0 ) == spool->bytes )
+		{
+			buffer[ spool->bytes ] = '\0';
+			response = connection_push( connection, command, buffer, spool->bytes );
+		}
+		else
+		{
+			response = mvcp_response_init( );
+			mvcp_response_set_error( response, RESPONSE_ERROR, "Unable to read the document" );
+		}
+		free( buffer );
+	}
+
+	connection_spool_close( spool );
+	return response;
+}
+
+/** Discard a spool.
+*/
+
+void connection_spool_close( connection_spool spool )
+{
+	if ( spool->fd >= 0 )
+	{
+		close( spool->fd );
+		unlink( spool->path );
+		spool->fd = -1;
+	}
+}
+
+/** Receive a chunked body with blocking reads and handle it. Returns NULL if
+	the body is malformed or the connection failed part way.
+*/
+
+static mvcp_response connection_push_chunked( connection_t *connection, mvcp_reader reader, char *command )
+{
+	connection_spool_t spool;
+	char chunk[ 16384 ];
+	char size[ 20 ];
 	int error = 0;
-	int index = 0;
-	mvcp_status_t status;
+
+	connection_spool_open( &spool );
+
+	while ( !error && !spool.done )
+	{
+		if ( spool.remaining == 0 )
+		{
+			error = !connection_read( reader, size, sizeof( size ) ) || connection_spool_size( &spool, size );
+		}
+		else
+		{
+			int length = mvcp_reader_read( reader, chunk, spool.remaining < sizeof( chunk ) ? spool.remaining : sizeof( chunk ) );
+			error = length <= 0;
+			if ( !error )
+				connection_spool_write( &spool, chunk, length );
+		}
+	}
+
+	if ( error )
+	{
+		connection_spool_close( &spool );
+		return NULL;
+	}
+
+	return connection_push_spool( connection, command, &spool );
+}
+
+/** Seconds between full status lines for a unit in a delta stream.
+*/
+
+#define CONNECTION_KEYFRAME 10
+
+/** Milliseconds between attempts to write status lines a client hasn't taken.
+*/
+
+#define CONNECTION_RETRY 50
+
+/** State of a unit for a STATUS subscriber.
+*/
+
+typedef struct
+{
+	mvcp_status_record_t sent;
+	time_t keyframe;
+	mvcp_status_record_t pending;
+	int held;
+	int64_t due;
+}
+connection_unit_t;
+
+/** State of a status subscriber - unit state grows with the units seen.
+*/
+
+struct connection_subscriber_s
+{
+	mvcp_notifier notifier;
+	unsigned long cursor;
+	mvcp_status_record_t status;
+	connection_emitter emit;
+	void *arg;
+	char prefix[ 8 ];
+	int fresh;
+	int delta;
+	int interval;
+	connection_unit_t *units;
+	int count;
+	int held;
+};
+
+/** Get the time in milliseconds.
+*/
+
+static int64_t connection_clock( )
+{
+	struct timeval now;
+	gettimeofday( &now, NULL );
+	return ( int64_t )now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/** Locate the subscriber's state for a unit, growing the table as needed.
+*/
+
+static connection_unit_t *connection_subscriber_unit( connection_subscriber_t *subscriber, int unit )
+{
+	if ( unit < 0 || unit >= MAX_UNITS )
+		return NULL;
+
+	if ( unit >= subscriber->count )
+	{
+		int count = subscriber->count == 0 ? MVCP_NOTIFIER_BLOCK : subscriber->count;
+		connection_unit_t *units = NULL;
+		while ( count <= unit )
+			count *= 2;
+		units = realloc( subscriber->units, count * sizeof( connection_unit_t ) );
+		if ( units == NULL )
+			return NULL;
+		memset( units + subscriber->count, 0, ( count - subscriber->count ) * sizeof( connection_unit_t ) );
+		subscriber->units = units;
+		subscriber->count = count;
+	}
+
+	return &subscriber->units[ unit ];
+}
+
+/** Send a status record to a subscriber - as a full line if asked, if the
+	subscriber doesn't want deltas or if the unit is due a keyframe, and
+	otherwise as the fields which have changed since the last line.
+*/
+
+static int connection_status_send( connection_subscriber_t *subscriber, mvcp_status_record status, int full )
+{
 	char text[ 10240 ];
-	mvcp_socket socket = mvcp_socket_init_fd( fd );
-	
-	for ( index = 0; !error && index < MAX_UNITS; index ++ )
+	int offset = strlen( subscriber->prefix );
+	connection_unit_t *unit = connection_subscriber_unit( subscriber, status->unit );
+
+	strcpy( text, subscriber->prefix );
+
+	if ( unit == NULL )
 	{
-		mvcp_notifier_get( notifier, &status, index );
-		mvcp_status_serialise( &status, text, sizeof( text ) );
-		error = mvcp_socket_write_data( socket, text, strlen( text )  ) != strlen( text );
+		mvcp_status_record_serialise( status, text + offset, sizeof( text ) - offset );
 	}
+	else if ( full || !subscriber->delta || time( NULL ) - unit->keyframe >= CONNECTION_KEYFRAME )
+	{
+		mvcp_status_record_serialise( status, text + offset, sizeof( text ) - offset );
 
-	while ( !error )
+		/* Job outcomes aren't part of a full line, so a delta follows it */
+		if ( subscriber->delta && ( status->job != unit->sent.job || status->job_state != unit->sent.job_state ) )
+		{
+			mvcp_status_record_t previous = *status;
+			int used = strlen( text );
+			previous.job = unit->sent.job;
+			previous.job_state = unit->sent.job_state;
+			snprintf( text + used, sizeof( text ) - used, "%s", subscriber->prefix );
+			used += strlen( text + used );
+			mvcp_status_record_delta( &previous, status, text + used, sizeof( text ) - used );
+		}
+
+		unit->keyframe = time( NULL );
+		mvcp_status_record_copy( &unit->sent, status );
+	}
+	else
+	{
+		mvcp_status_record_delta( &unit->sent, status, text + offset, sizeof( text ) - offset );
+		mvcp_status_record_copy( &unit->sent, status );
+		/* Nothing the client sees has changed - a bare prefix would run
+		   into the next line */
+		if ( text[ offset ] == '\0' )
+			return 0;
+	}
+
+	return subscriber->emit( subscriber->arg, text, strlen( text ) );
+}
+
+/** Determine if a record only differs from the last one sent in its
+	positions - these are the changes which are throttled.
+*/
+
+static int connection_status_moved( mvcp_status_record sent, mvcp_status_record status )
+{
+	mvcp_status_record_t moved = *sent;
+	moved.position = status->position;
+	moved.tail_position = status->tail_position;
+	moved.dummy = status->dummy;
+	return !mvcp_status_record_compare( &moved, status );
+}
+
+/** Deliver a status event to a subscriber. When the subscriber has asked for
+	an interval, position changes for a unit are held back until the interval
+	has passed since the last line for the unit and only the latest is sent.
+*/
+
+static int connection_status_post( connection_subscriber_t *subscriber, mvcp_status_record status )
+{
+	connection_unit_t *unit = NULL;
+	int64_t now = 0;
+
+	if ( subscriber->interval <= 0 || ( unit = connection_subscriber_unit( subscriber, status->unit ) ) == NULL )
+		return connection_status_send( subscriber, status, 0 );
+
+	now = connection_clock( );
+	if ( now < unit->due && connection_status_moved( &unit->sent, status ) )
+	{
+		mvcp_status_record_copy( &unit->pending, status );
+		subscriber->held += !unit->held;
+		unit->held = 1;
+		return 0;
+	}
+
+	subscriber->held -= unit->held;
+	unit->held = 0;
+	unit->due = now + subscriber->interval;
+	return connection_status_send( subscriber, status, 0 );
+}
+
+/** Send any held back events which are now due. Returns the number of
+	milliseconds until the next one is due (at most the given timeout) or -1
+	on error.
+*/
+
+static int connection_status_flush( connection_subscriber_t *subscriber, int timeout )
+{
+	int64_t now = connection_clock( );
+	int index = 0;
+
+	for ( index = 0; subscriber->held > 0 && index < subscriber->count; index ++ )
 	{
-		if ( mvcp_notifier_wait( notifier, &status ) == 0 )
+		connection_unit_t *unit = &subscriber->units[ index ];
+		if ( !unit->held )
+			continue;
+		if ( now >= unit->due )
 		{
-			mvcp_status_serialise( &status, text, sizeof( text ) );
-			error = mvcp_socket_write_data( socket, text, strlen( text ) ) != strlen( text );
+			unit->held = 0;
+			subscriber->held --;
+			unit->due = now + subscriber->interval;
+			if ( connection_status_send( subscriber, &unit->pending, 0 ) )
+				return -1;
 		}
-		else
+		else if ( unit->due - now < timeout )
 		{
-			struct timeval tv = { 0, 0 };
-			fd_set rfds;
+			timeout = unit->due - now;
+		}
+	}
+
+	return timeout;
+}
+
+/** Send the stored status of every unit.
+*/
+
+static int connection_status_all( connection_subscriber_t *subscriber )
+{
+	mvcp_notifier notifier = subscriber->notifier;
+	int error = 0;
+	int index = 0;
+	mvcp_status_record_t status;
+
+	memset( &status, 0, sizeof( status ) );
+	for ( index = 0; !error && index < subscriber->count; index ++ )
+		subscriber->units[ index ].held = 0;
+	subscriber->held = 0;
+	for ( index = 0; !error && index < mvcp_notifier_count( notifier ); index ++ )
+	{
+		mvcp_notifier_get_record( notifier, &status, index );
+		error = connection_status_send( subscriber, &status, 1 );
+	}
+	mvcp_status_record_clear( &status );
+
+	return error;
+}
+
+/** Subscribe to the status events of the notifier. The command may ask for
+	a DELTA stream and an INTERVAL=ms between position updates for each unit.
+	Every line is emitted with the prefix in front of it, starting with the
+	current status of every unit.
+*/
+
+connection_subscriber connection_subscribe( mvcp_notifier notifier, char *command, const char *prefix, connection_emitter emit, void *arg )
+{
+	connection_subscriber subscriber = calloc( 1, sizeof( connection_subscriber_t ) );
+
+	if ( subscriber != NULL )
+	{
+		mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
+		int index = 0;
 
-		    FD_ZERO( &rfds );
-		    FD_SET( fd, &rfds );
+		/* Subscribing first means that nothing is missed by the full status sent first */
+		subscriber->notifier = notifier;
+		subscriber->cursor = mvcp_notifier_subscribe( notifier );
+		subscriber->emit = emit;
+		subscriber->arg = arg;
+		subscriber->fresh = 1;
+		snprintf( subscriber->prefix, sizeof( subscriber->prefix ), "%s", prefix );
 
-			if ( select( socket->fd + 1, &rfds, NULL, NULL, &tv ) )
-				error = 1;
+		mvcp_tokeniser_parse_new( tokeniser, command, " " );
+		for ( index = 1; index < mvcp_tokeniser_count( tokeniser ); index ++ )
+		{
+			char *option = mvcp_tokeniser_get_string( tokeniser, index );
+			if ( !strcasecmp( option, "DELTA" ) )
+				subscriber->delta = 1;
+			else if ( !strncasecmp( option, "INTERVAL=", 9 ) )
+				subscriber->interval = atoi( option + 9 );
 		}
+		mvcp_tokeniser_close( tokeniser );
 	}
 
-	mvcp_socket_close( socket );
+	return subscriber;
+}
+
+/** Deliver the next status event, waiting up to timeout milliseconds for one.
+	Returns 0 when something was sent, ETIMEDOUT when nothing arrived and -1
+	on error.
+*/
+
+static int connection_subscriber_next( connection_subscriber_t *subscriber, int timeout )
+{
+	int result = 0;
+
+	if ( subscriber->fresh )
+	{
+		subscriber->fresh = 0;
+		return connection_status_all( subscriber ) ? -1 : 0;
+	}
+
+	timeout = connection_status_flush( subscriber, timeout );
+	if ( timeout < 0 )
+		return -1;
+
+	result = mvcp_notifier_next_record( subscriber->notifier, &subscriber->cursor, &subscriber->status, timeout );
+	if ( result == 0 )
+		return connection_status_post( subscriber, &subscriber->status ) ? -1 : 0;
+	else if ( result == -1 )
+		/* Events were lost while we were writing - send everything again */
+		return connection_status_all( subscriber ) ? -1 : 0;
+
+	return ETIMEDOUT;
+}
+
+/** Deliver the status events which are available without waiting. Returns
+	the milliseconds until held back events are due (at most timeout), 0 if
+	there is more to deliver or -1 on error.
+*/
+
+int connection_subscriber_pump( connection_subscriber subscriber, int timeout )
+{
+	int result = 0;
+	int count = 0;
+
+	while ( result == 0 && count ++ < MVCP_NOTIFIER_RING )
+		result = connection_subscriber_next( subscriber, 0 );
+
+	if ( result < 0 )
+		return -1;
+	else if ( result == 0 )
+		return 0;
+
+	return connection_status_flush( subscriber, timeout );
+}
+
+/** Release the subscriber.
+*/
+
+void connection_unsubscribe( connection_subscriber subscriber )
+{
+	if ( subscriber != NULL )
+	{
+		int index = 0;
+		for ( index = 0; index < subscriber->count; index ++ )
+		{
+			mvcp_status_record_clear( &subscriber->units[ index ].sent );
+			mvcp_status_record_clear( &subscriber->units[ index ].pending );
+		}
+		mvcp_status_record_clear( &subscriber->status );
+		free( subscriber->units );
+		free( subscriber );
+	}
+}
+
+/** Emitter which queues status lines on a socket.
+*/
+
+static int connection_status_emit( void *arg, const char *data, int length )
+{
+	return mvcp_socket_send( arg, data, length ) < 0;
+}
+
+/** Stream status to a client until it goes away. 
+*/
+
+int connection_status( int fd, mvcp_notifier notifier, char *command )
+{
+	int error = 0;
+	mvcp_socket socket = mvcp_socket_init_fd( fd );
+	connection_subscriber subscriber = socket == NULL ? NULL : connection_subscribe( notifier, command, "", connection_status_emit, socket );
+
+	error = subscriber == NULL;
+
+	while ( !error )
+	{
+		/* Lines the client hasn't taken yet are retried often - a client which
+		   lets too much back up is dropped by mvcp_socket_send */
+		int pending = mvcp_socket_flush( socket );
+		int result = pending < 0 ? -1 : connection_subscriber_next( subscriber, pending > 0 ? CONNECTION_RETRY : 1000 );
+		if ( result < 0 )
+			error = 1;
+		else if ( result == ETIMEDOUT && mvcp_socket_wait( socket, POLLIN, 0 ) != 0 )
+			error = 1;
+	}
+
+	connection_unsubscribe( subscriber );
+	if ( socket != NULL )
+		mvcp_socket_close( socket );
 	
 	return error;
 }
 
+/** Emitter which writes straight to a blocking descriptor.
+*/
+
+static int connection_emit( void *arg, const char *data, int length )
+{
+	int fd = *( int * )arg;
+	while ( length > 0 )
+	{
+		ssize_t written = write( fd, data, length );
+		if ( written < 0 && errno == EINTR )
+			continue;
+		if ( written <= 0 )
+			return -1;
+		data += written;
+		length -= written;
+	}
+	return 0;
+}
+
+/** A WATCH on a threaded connection - the notifier writes to the pipe when
+	there is something to send.
+*/
+
+typedef struct
+{
+	int fd;
+	int pipe[ 2 ];
+	mvcp_notifier notifier;
+	mvcp_notifier_watch watch;
+	connection_subscriber subscriber;
+}
+connection_watch_t;
+
+/** Start (WATCH) or stop (UNWATCH) interleaving status with the responses.
+*/
+
+static mvcp_response connection_watch( connection_t *connection, connection_watch_t *watch, char *command )
+{
+	mvcp_response response = mvcp_response_init( );
+
+	connection_unsubscribe( watch->subscriber );
+	watch->subscriber = NULL;
+
+	if ( !strncasecmp( command, "WATCH", 5 ) )
+	{
+		if ( watch->watch == NULL && pipe( watch->pipe ) == 0 )
+		{
+			fcntl( watch->pipe[ 0 ], F_SETFL, O_NONBLOCK );
+			fcntl( watch->pipe[ 1 ], F_SETFL, O_NONBLOCK );
+			watch->notifier = mvcp_parser_get_notifier( connection->parser );
+			watch->watch = mvcp_notifier_watch_init( watch->notifier, watch->pipe[ 1 ] );
+		}
+		if ( watch->watch != NULL )
+			watch->subscriber = connection_subscribe( watch->notifier, command, "* ", connection_emit, &watch->fd );
+		if ( watch->subscriber == NULL )
+			mvcp_response_set_error( response, RESPONSE_ERROR, "Unable to watch" );
+	}
+
+	if ( mvcp_response_count( response ) == 0 )
+		mvcp_response_set_error( response, RESPONSE_SUCCESS, "OK" );
+
+	melted_log( LOG_INFO, "%s \"%s\" %d", connection->address, command, mvcp_response_get_error_code( response ) );
+	return response;
+}
+
+/** Send status events while waiting for the next command. Returns non-zero
+	if the client can't be written to.
+*/
+
+static int connection_watch_wait( connection_watch_t *watch, mvcp_reader reader )
+{
+	while ( watch->subscriber != NULL && mvcp_reader_available( reader ) == 0 )
+	{
+		struct pollfd pfd[ 2 ];
+		int timeout = 0;
+
+		/* Arming first means nothing put while we catch up is missed */
+		mvcp_notifier_watch_arm( watch->notifier, watch->watch );
+		timeout = connection_subscriber_pump( watch->subscriber, 1000 );
+		if ( timeout < 0 )
+			return -1;
+
+		pfd[ 0 ].fd = watch->fd;
+		pfd[ 0 ].events = POLLIN;
+		pfd[ 1 ].fd = watch->pipe[ 0 ];
+		pfd[ 1 ].events = POLLIN;
+		if ( poll( pfd, 2, timeout ) < 0 )
+			continue;
+		if ( pfd[ 1 ].revents & POLLIN )
+		{
+			char drain[ 64 ];
+			while ( read( watch->pipe[ 0 ], drain, sizeof( drain ) ) > 0 ) ;
+		}
+		if ( pfd[ 0 ].revents != 0 )
+			break;
+	}
+	return 0;
+}
+
+/** Release the watch.
+*/
+
+static void connection_watch_close( connection_watch_t *watch )
+{
+	connection_unsubscribe( watch->subscriber );
+	if ( watch->watch != NULL )
+	{
+		mvcp_notifier_watch_close( watch->notifier, watch->watch );
+		close( watch->pipe[ 0 ] );
+		close( watch->pipe[ 1 ] );
+	}
+}
+
 static void connection_close( int fd )
 {
 	close( fd );
@@ -201,30 +959,28 @@ static void connection_close( int fd )
 
 void *parser_thread( void *arg )
 {
-	struct hostent *he;
 	connection_t *connection = arg;
-	mlt_properties owner = connection->owner;
-	char address[ 512 ];
 	char command[ 1024 ];
 	int fd = connection->fd;
 	mvcp_parser parser = connection->parser;
 	mvcp_response response = NULL;
+	mvcp_reader reader = mvcp_reader_init( fd, 0 );
+	connection_watch_t watch;
+
+	memset( &watch, 0, sizeof( watch ) );
+	watch.fd = fd;
 
 	/* Get the connecting clients ip information */
-	he = gethostbyaddr( (char *) &( connection->sin.sin_addr.s_addr ), sizeof(u_int32_t), AF_INET); 
-	if ( he != NULL )
-		strcpy( address, he->h_name );
-	else
-		inet_ntop( AF_INET, &( connection->sin.sin_addr.s_addr), address, 32 );
+	connection_resolve( connection, 0 );
 
-	melted_log( LOG_NOTICE, "Connection established with %s (%d)", address, fd );
+	melted_log( LOG_NOTICE, "Connection established with %s (%d)", connection->address, fd );
 
 	/* Execute the commands received. */
-	if ( connection_initiate( fd ) == 0 )
+	if ( reader != NULL && connection_initiate( fd ) == 0 )
 	{
 		int error = 0;
 
-		while( !error && connection_read( fd, command, 1024 ) )
+		while( !error && connection_watch_wait( &watch, reader ) == 0 && connection_read( reader, command, 1024 ) )
 		{
 			response = NULL;
 
@@ -233,81 +989,67 @@ void *parser_thread( void *arg )
 				// Ignore blank lines
 				continue;
 			}
-			if ( !strncmp( command, "PUSH ", 5 ) )
+			if ( !strncmp( command, "PUSH ", 5 ) || !strncmp( command, "BATCH ", 6 ) )
 			{
-				// Append XML as clip
+				// Append XML as clip or apply a batch of playlist changes
 				char temp[ 20 ];
 				int bytes;
 				char *buffer = NULL;
 				int total = 0;
-				mlt_service service = NULL;
 
-				connection_read( fd, temp, 20 );
-				bytes = atoi( temp );
-				buffer = malloc( bytes + 1 );
-				while ( total < bytes )
+				connection_read( reader, temp, 20 );
+				if ( !strcmp( temp, "chunked" ) )
 				{
-					int count = read( fd, buffer + total, bytes - total );
-					if ( count >= 0 )
-						total += count;
-					else
-						break;
-				}
-				buffer[ bytes ] = '\0';
-				if ( bytes > 0 && total == bytes )
-				{
-					if ( mlt_properties_get( owner, "push-parser-off" ) == 0 )
-					{
-						mlt_profile profile = mlt_profile_init( NULL );
-						profile->is_explicit = 1;
-						service = ( mlt_service )mlt_factory_producer( profile, "xml-string", buffer );
-						if ( service )
-						{
-							mlt_properties_set_data( MLT_SERVICE_PROPERTIES( service ), "melted_profile", profile,
-								0, (mlt_destructor) mlt_profile_close, NULL );
-							mlt_events_fire( owner, "push-received", &response, command, service, NULL );
-							if ( response == NULL )
-								response = mvcp_parser_push( parser, command, service );
-						}
-						else
-						{
-							response = mvcp_response_init();
-							mvcp_response_set_error( response, RESPONSE_BAD_FILE, "Failed to load XML" );
-						}
-					}
-					else
+					// The body follows as chunks, each preceded by its size in hex - a
+					// malformed or incomplete body leaves the stream out of step
+					response = connection_push_chunked( connection, reader, command );
+					if ( response == NULL )
 					{
-						response = mvcp_parser_received( parser, command, buffer );
+						error = 1;
+						continue;
 					}
 				}
-				melted_log( LOG_INFO, "%s \"%s\" %d", address, command, mvcp_response_get_error_code( response ) );
+				else
+				{
+					bytes = atoi( temp );
+					buffer = malloc( bytes + 1 );
+					total = mvcp_reader_read( reader, buffer, bytes );
+					buffer[ bytes ] = '\0';
+					if ( total == bytes )
+						response = connection_push( connection, command, buffer, bytes );
+				}
 				error = connection_send( fd, response );
 				mvcp_response_close( response );
-				mlt_service_close( service );
 				free( buffer );
 			}
+			else if ( !strncasecmp( command, "WATCH", 5 ) || !strncasecmp( command, "UNWATCH", 7 ) )
+			{
+				// Interleave status with the responses (or stop doing so)
+				response = connection_watch( connection, &watch, command );
+				error = connection_send( fd, response );
+				mvcp_response_close( response );
+			}
 			else if ( strncmp( command, "STATUS", 6 ) )
 			{
 				// All other commands
-				mlt_events_fire( owner, "command-received", &response, command, NULL );
-				if ( response == NULL )
-					response = mvcp_parser_execute( parser, command );
-				melted_log( LOG_INFO, "%s \"%s\" %d", address, command, mvcp_response_get_error_code( response ) );
+				response = connection_execute( connection, command );
 				error = connection_send( fd, response );
 				mvcp_response_close( response );
 			}
 			else
 			{
 				// Start sending status repeatedly
-				error = connection_status( fd, mvcp_parser_get_notifier( parser ) );
+				error = connection_status( fd, mvcp_parser_get_notifier( parser ), command );
 			}
 		}
 	}
 
 	/* Free the resources associated with this connection. */
+	connection_watch_close( &watch );
+	mvcp_reader_close( reader );
 	connection_close( fd );
 
-	melted_log( LOG_NOTICE, "Connection with %s (%d) closed", address, fd );
+	melted_log( LOG_NOTICE, "Connection with %s (%d) closed", connection->address, fd );
 
 	free( connection );
 
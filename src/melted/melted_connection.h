@@ -42,6 +42,7 @@ typedef struct
 	int fd;
 	struct sockaddr_in sin;
 	mvcp_parser parser;
+	char address[ 512 ];
 } 
 connection_t;
 
@@ -83,6 +84,39 @@ command_argument_t, *command_argument;
 typedef int (*command_handler_t) ( command_argument );
 
 
+/* An emitter receives the wire form of a response in pieces. */
+typedef int (*connection_emitter)( void *, const char *, int );
+
+extern int connection_format( mvcp_response, connection_emitter, void * );
+extern void connection_resolve( connection_t *, int );
+extern mvcp_response connection_execute( connection_t *, char * );
+extern mvcp_response connection_push( connection_t *, char *, char *, int );
+extern int connection_status( int fd, mvcp_notifier, char * );
+
+/* A chunked PUSH or BATCH body spooled to a temporary file as it arrives. */
+typedef struct
+{
+	int fd;
+	char path[ 512 ];
+	int remaining;
+	int bytes;
+	int error;
+	int done;
+}
+connection_spool_t, *connection_spool;
+
+extern void connection_spool_open( connection_spool );
+extern int connection_spool_size( connection_spool, char * );
+extern void connection_spool_write( connection_spool, char *, int );
+extern mvcp_response connection_push_spool( connection_t *, char *, connection_spool );
+extern void connection_spool_close( connection_spool );
+
+/* A subscriber emits status lines as the notifier receives them. */
+typedef struct connection_subscriber_s connection_subscriber_t, *connection_subscriber;
+
+extern connection_subscriber connection_subscribe( mvcp_notifier, char *, const char *, connection_emitter, void * );
+extern int connection_subscriber_pump( connection_subscriber, int );
+extern void connection_unsubscribe( connection_subscriber );
 extern void *parser_thread( void *arg );
 
 #ifdef __cplusplus
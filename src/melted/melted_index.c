@@ -0,0 +1,607 @@
+/*
+ * melted_index.c -- Directory Index
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/* Application header files */
+#include "melted_index.h"
+#include "melted_log.h"
+
+/** Maximum number of changes remembered for a directory while it is scanned.
+*/
+
+#define PENDING_SIZE 256
+
+/** A directory entry - names are kept in the order of alphasort.
+*/
+
+typedef struct
+{
+	char *name;
+	int dir;
+	int file;
+	unsigned long long size;
+	time_t mtime;
+}
+melted_index_entry_t, *melted_index_entry;
+
+/** An indexed directory.
+*/
+
+typedef struct melted_index_dir_s
+{
+	char *path;
+	int wd;
+	int building;
+	int stale;
+	int touched;
+	time_t mtime;
+	melted_index_entry entries;
+	int count;
+	int size;
+	char *pending[ PENDING_SIZE ];
+	int pending_count;
+	struct melted_index_dir_s *prev;
+	struct melted_index_dir_s *next;
+}
+*melted_index_dir, melted_index_dir_t;
+
+/** The index - directories are kept most recently used first.
+*/
+
+static struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int fd;
+	int initialised;
+	melted_index_dir head;
+	int count;
+}
+g_index = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, -1, 0, NULL, 0 };
+
+static int filter_files( const struct dirent *de )
+{
+	return de->d_name[ 0 ] != '.';
+}
+
+/** Determine how a name in a directory is listed - returns 0 when it is not
+	listed at all.
+*/
+
+static int melted_index_stat( const char *path, const char *name, melted_index_entry entry )
+{
+	char fullname[ PATH_MAX ];
+	struct stat info;
+
+	snprintf( fullname, sizeof( fullname ), "%s/%s", path, name );
+	entry->dir = stat( fullname, &info ) == 0 && S_ISDIR( info.st_mode );
+	entry->mtime = entry->dir ? info.st_mtime : 0;
+	entry->file = lstat( fullname, &info ) == 0 &&
+		( S_ISREG( info.st_mode ) || S_ISLNK( info.st_mode ) || strstr( name, ".clip" ) );
+	entry->size = entry->file ? ( unsigned long long )info.st_size : 0;
+	if ( entry->file )
+		entry->mtime = info.st_mtime;
+
+	return entry->dir || entry->file;
+}
+
+/** Find the position of a name, returning the position it would be inserted
+	at when it is not found.
+*/
+
+static int melted_index_find( melted_index_dir dir, const char *name, int *found )
+{
+	int low = 0;
+	int high = dir->count;
+
+	*found = 0;
+	while ( low < high )
+	{
+		int middle = ( low + high ) / 2;
+		int order = strcoll( dir->entries[ middle ].name, name );
+		if ( order == 0 )
+		{
+			*found = 1;
+			return middle;
+		}
+		else if ( order < 0 )
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+/** Bring a single name of an indexed directory up to date.
+*/
+
+static void melted_index_update( melted_index_dir dir, const char *name )
+{
+	melted_index_entry_t entry;
+	int found = 0;
+	int index = melted_index_find( dir, name, &found );
+	int listed = melted_index_stat( dir->path, name, &entry );
+
+	if ( found && listed )
+	{
+		dir->entries[ index ].dir = entry.dir;
+		dir->entries[ index ].file = entry.file;
+		dir->entries[ index ].size = entry.size;
+		dir->entries[ index ].mtime = entry.mtime;
+	}
+	else if ( found )
+	{
+		free( dir->entries[ index ].name );
+		memmove( &dir->entries[ index ], &dir->entries[ index + 1 ], ( dir->count - index - 1 ) * sizeof( melted_index_entry_t ) );
+		dir->count --;
+	}
+	else if ( listed )
+	{
+		if ( dir->count == dir->size )
+		{
+			int size = dir->size ? dir->size * 2 : 64;
+			melted_index_entry entries = realloc( dir->entries, size * sizeof( melted_index_entry_t ) );
+			if ( entries == NULL )
+			{
+				dir->stale = 1;
+				return;
+			}
+			dir->entries = entries;
+			dir->size = size;
+		}
+		entry.name = strdup( name );
+		if ( entry.name == NULL )
+		{
+			dir->stale = 1;
+			return;
+		}
+		memmove( &dir->entries[ index + 1 ], &dir->entries[ index ], ( dir->count - index ) * sizeof( melted_index_entry_t ) );
+		dir->entries[ index ] = entry;
+		dir->count ++;
+	}
+}
+
+/** Note a change to a name in an indexed directory.
+*/
+
+static void melted_index_changed( melted_index_dir dir, const char *name )
+{
+	if ( name[ 0 ] == '.' )
+		return;
+
+	if ( dir->building )
+	{
+		if ( dir->pending_count < PENDING_SIZE && ( dir->pending[ dir->pending_count ] = strdup( name ) ) != NULL )
+			dir->pending_count ++;
+		else
+			dir->stale = 1;
+	}
+	else
+	{
+		melted_index_update( dir, name );
+		dir->touched = 1;
+	}
+}
+
+static void melted_index_free_entries( melted_index_entry entries, int count )
+{
+	int i;
+	for ( i = 0; i < count; i ++ )
+		free( entries[ i ].name );
+	free( entries );
+}
+
+/** Release a directory - it must already be unlinked from the index.
+*/
+
+static void melted_index_dir_close( melted_index_dir dir )
+{
+	int i;
+#ifdef __linux__
+	melted_index_dir other = NULL;
+	for ( other = g_index.head; other != NULL && other->wd != dir->wd; other = other->next ) ;
+	if ( dir->wd >= 0 && g_index.fd >= 0 && other == NULL )
+		inotify_rm_watch( g_index.fd, dir->wd );
+#endif
+	for ( i = 0; i < dir->pending_count; i ++ )
+		free( dir->pending[ i ] );
+	melted_index_free_entries( dir->entries, dir->count );
+	free( dir->path );
+	free( dir );
+}
+
+static void melted_index_unlink( melted_index_dir dir )
+{
+	if ( dir->prev != NULL )
+		dir->prev->next = dir->next;
+	else
+		g_index.head = dir->next;
+	if ( dir->next != NULL )
+		dir->next->prev = dir->prev;
+	dir->prev = dir->next = NULL;
+	g_index.count --;
+}
+
+static void melted_index_link( melted_index_dir dir )
+{
+	dir->prev = NULL;
+	dir->next = g_index.head;
+	if ( g_index.head != NULL )
+		g_index.head->prev = dir;
+	g_index.head = dir;
+	g_index.count ++;
+}
+
+/** Apply the changes reported by inotify - must be called with the mutex held.
+*/
+
+static void melted_index_drain( )
+{
+#ifdef __linux__
+	union
+	{
+		struct inotify_event event;
+		char data[ 8192 ];
+	}
+	buffer;
+	ssize_t length = 0;
+	melted_index_dir dir = NULL;
+
+	if ( g_index.fd < 0 )
+		return;
+
+	while ( ( length = read( g_index.fd, buffer.data, sizeof( buffer.data ) ) ) > 0 )
+	{
+		char *ptr = buffer.data;
+		while ( ptr < buffer.data + length )
+		{
+			struct inotify_event *event = ( struct inotify_event * )ptr;
+			ptr += sizeof( struct inotify_event ) + event->len;
+
+			if ( event->mask & IN_Q_OVERFLOW )
+			{
+				melted_log( LOG_NOTICE, "directory index overflowed, rescanning" );
+				for ( dir = g_index.head; dir != NULL; dir = dir->next )
+					dir->stale = 1;
+				continue;
+			}
+
+			/* The same directory may be indexed under more than one path */
+			for ( dir = g_index.head; dir != NULL; dir = dir->next )
+			{
+				if ( dir->wd != event->wd )
+					continue;
+				if ( event->mask & IN_IGNORED )
+					dir->wd = -1;
+				if ( event->mask & ( IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT ) )
+					dir->stale = 1;
+				else if ( event->len > 0 )
+					melted_index_changed( dir, event->name );
+			}
+		}
+	}
+
+	/* Changes made here move the directory's modification time on */
+	for ( dir = g_index.head; dir != NULL; dir = dir->next )
+	{
+		struct stat info;
+		if ( dir->touched && stat( dir->path, &info ) == 0 )
+			dir->mtime = info.st_mtime;
+		dir->touched = 0;
+	}
+#endif
+}
+
+/** Start watching a directory - must be called with the mutex held.
+*/
+
+static int melted_index_watch( const char *path )
+{
+	int wd = -1;
+#ifdef __linux__
+	if ( !g_index.initialised )
+	{
+		g_index.fd = inotify_init( );
+		if ( g_index.fd >= 0 )
+		{
+			fcntl( g_index.fd, F_SETFL, fcntl( g_index.fd, F_GETFL ) | O_NONBLOCK );
+			fcntl( g_index.fd, F_SETFD, FD_CLOEXEC );
+		}
+		g_index.initialised = 1;
+	}
+	if ( g_index.fd >= 0 )
+		wd = inotify_add_watch( g_index.fd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+			IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR );
+#endif
+	return wd;
+}
+
+/** Read a directory in full - called without the mutex held.
+*/
+
+static int melted_index_scan( const char *path, melted_index_entry *result, int *count )
+{
+	struct dirent **de = NULL;
+	melted_index_entry entries = NULL;
+	int n = scandir( path, &de, filter_files, alphasort );
+	int used = 0;
+	int i;
+
+	if ( n < 0 )
+		return -1;
+
+	entries = malloc( ( n > 0 ? n : 1 ) * sizeof( melted_index_entry_t ) );
+	for ( i = 0; i < n; i ++ )
+	{
+		if ( entries != NULL && melted_index_stat( path, de[ i ]->d_name, &entries[ used ] ) )
+		{
+			entries[ used ].name = strdup( de[ i ]->d_name );
+			if ( entries[ used ].name != NULL )
+				used ++;
+		}
+		free( de[ i ] );
+	}
+	free( de );
+
+	*result = entries;
+	*count = used;
+	return entries != NULL ? 0 : -1;
+}
+
+/** Get the index of a directory, reading it when it is not indexed or has
+	changed - the mutex is held on entry and exit.
+*/
+
+static melted_index_dir melted_index_get( const char *path )
+{
+	melted_index_dir dir = NULL;
+	struct stat info;
+
+	while ( 1 )
+	{
+		melted_index_drain( );
+
+		for ( dir = g_index.head; dir != NULL && strcmp( dir->path, path ); dir = dir->next ) ;
+
+		if ( dir != NULL && dir->building )
+		{
+			pthread_cond_wait( &g_index.cond, &g_index.mutex );
+			continue;
+		}
+
+		/* Changes which inotify can't see (eg: from other hosts on a network share) still move the mtime */
+		if ( stat( path, &info ) != 0 || !S_ISDIR( info.st_mode ) )
+		{
+			if ( dir != NULL )
+			{
+				melted_index_unlink( dir );
+				melted_index_dir_close( dir );
+			}
+			return NULL;
+		}
+
+		if ( dir != NULL && !dir->stale && dir->mtime == info.st_mtime )
+		{
+			melted_index_unlink( dir );
+			melted_index_link( dir );
+			return dir;
+		}
+
+		break;
+	}
+
+	if ( dir == NULL )
+	{
+		dir = calloc( 1, sizeof( melted_index_dir_t ) );
+		if ( dir == NULL || ( dir->path = strdup( path ) ) == NULL )
+		{
+			free( dir );
+			return NULL;
+		}
+		dir->wd = melted_index_watch( path );
+		melted_index_link( dir );
+	}
+	else if ( dir->wd < 0 )
+	{
+		dir->wd = melted_index_watch( path );
+	}
+
+	/* Scan without the lock, collecting any changes reported meanwhile */
+	dir->building = 1;
+	dir->stale = 0;
+	dir->mtime = info.st_mtime;
+	pthread_mutex_unlock( &g_index.mutex );
+
+	{
+		melted_index_entry entries = NULL;
+		int count = 0;
+		int error = melted_index_scan( path, &entries, &count );
+		int i;
+
+		pthread_mutex_lock( &g_index.mutex );
+		melted_index_drain( );
+
+		melted_index_free_entries( dir->entries, dir->count );
+		dir->entries = entries;
+		dir->count = count;
+		dir->size = count;
+		dir->building = 0;
+		if ( error )
+			dir->stale = 1;
+
+		for ( i = 0; i < dir->pending_count; i ++ )
+		{
+			melted_index_update( dir, dir->pending[ i ] );
+			free( dir->pending[ i ] );
+			dir->touched = 1;
+		}
+		dir->pending_count = 0;
+		if ( dir->touched && stat( path, &info ) == 0 )
+			dir->mtime = info.st_mtime;
+		dir->touched = 0;
+		pthread_cond_broadcast( &g_index.cond );
+
+		if ( error )
+		{
+			melted_index_unlink( dir );
+			melted_index_dir_close( dir );
+			return NULL;
+		}
+	}
+
+	/* Drop the least recently used directories */
+	while ( g_index.count > MELTED_INDEX_DIRS )
+	{
+		melted_index_dir last = g_index.head;
+		while ( last->next != NULL )
+			last = last->next;
+		while ( last != NULL && ( last->building || last == dir ) )
+			last = last->prev;
+		if ( last == NULL )
+			break;
+		melted_index_unlink( last );
+		melted_index_dir_close( last );
+	}
+
+	return dir;
+}
+
+static int melted_index_by_size_order( const void *a, const void *b )
+{
+	melted_index_entry first = *( melted_index_entry * )a;
+	melted_index_entry second = *( melted_index_entry * )b;
+	if ( first->size != second->size )
+		return first->size < second->size ? -1 : 1;
+	return strcoll( first->name, second->name );
+}
+
+static int melted_index_by_mtime_order( const void *a, const void *b )
+{
+	melted_index_entry first = *( melted_index_entry * )a;
+	melted_index_entry second = *( melted_index_entry * )b;
+	if ( first->mtime != second->mtime )
+		return first->mtime < second->mtime ? -1 : 1;
+	return strcoll( first->name, second->name );
+}
+
+/** List a directory as CLS does - subdirectories first, then files, each in
+	the order requested. Only names matching the glob in the query are
+	listed, rows before the offset are skipped and at most limit rows are
+	listed (all of them when limit is negative). Returns -1 when the
+	directory can't be read.
+*/
+
+int melted_index_list( const char *directory, melted_index_query query, mvcp_response response )
+{
+	char path[ PATH_MAX ];
+	int length = snprintf( path, sizeof( path ), "%s", directory );
+	melted_index_dir dir = NULL;
+	melted_index_entry *rows = NULL;
+	int row = 0;
+	int pass;
+	int i;
+
+	while ( length > 1 && path[ length - 1 ] == '/' )
+		path[ -- length ] = '\0';
+
+	pthread_mutex_lock( &g_index.mutex );
+
+	dir = melted_index_get( path );
+	rows = dir != NULL ? malloc( ( dir->count + 1 ) * sizeof( melted_index_entry ) ) : NULL;
+	if ( rows == NULL )
+	{
+		pthread_mutex_unlock( &g_index.mutex );
+		return -1;
+	}
+
+	for ( pass = 0; pass < 2; pass ++ )
+	{
+		int count = 0;
+
+		for ( i = 0; i < dir->count; i ++ )
+		{
+			melted_index_entry entry = &dir->entries[ i ];
+			if ( pass == 0 ? !entry->dir : !entry->file )
+				continue;
+			if ( query->match != NULL && fnmatch( query->match, entry->name, 0 ) )
+				continue;
+			rows[ count ++ ] = entry;
+		}
+
+		if ( query->order == melted_index_by_size && pass == 1 )
+			qsort( rows, count, sizeof( melted_index_entry ), melted_index_by_size_order );
+		else if ( query->order == melted_index_by_mtime )
+			qsort( rows, count, sizeof( melted_index_entry ), melted_index_by_mtime_order );
+
+		for ( i = 0; i < count && ( query->limit < 0 || row < query->offset + query->limit ); i ++ )
+		{
+			melted_index_entry entry = rows[ query->descending ? count - i - 1 : i ];
+			if ( row ++ < query->offset )
+				continue;
+			if ( pass == 0 )
+				mvcp_response_printf( response, 1024, "\"%s/\"\n", entry->name );
+			else
+				mvcp_response_printf( response, 1024, "\"%s\" %llu\n", entry->name, entry->size );
+		}
+	}
+
+	pthread_mutex_unlock( &g_index.mutex );
+	free( rows );
+
+	return 0;
+}
+
+/** Release the index.
+*/
+
+void melted_index_close( )
+{
+	pthread_mutex_lock( &g_index.mutex );
+	while ( g_index.head != NULL )
+	{
+		melted_index_dir dir = g_index.head;
+		melted_index_unlink( dir );
+		melted_index_dir_close( dir );
+	}
+	if ( g_index.fd >= 0 )
+		close( g_index.fd );
+	g_index.fd = -1;
+	g_index.initialised = 0;
+	pthread_mutex_unlock( &g_index.mutex );
+}
@@ -0,0 +1,67 @@
+/*
+ * melted_index.h -- Directory Index
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_INDEX_H_
+#define _MELTED_INDEX_H_
+
+/* Application header files */
+#include <mvcp/mvcp_response.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Maximum number of directories held in the index.
+*/
+
+#define MELTED_INDEX_DIRS 32
+
+/** Orders in which a directory can be listed.
+*/
+
+typedef enum
+{
+	melted_index_by_name,
+	melted_index_by_size,
+	melted_index_by_mtime
+}
+melted_index_order;
+
+/** Which part of a directory to list and how.
+*/
+
+typedef struct
+{
+	int offset;
+	int limit;
+	const char *match;
+	melted_index_order order;
+	int descending;
+}
+melted_index_query_t, *melted_index_query;
+
+extern int melted_index_list( const char *, melted_index_query, mvcp_response );
+extern void melted_index_close( );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * melted_loader.c -- Asynchronous Clip Loading
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Application header files */
+#include "melted_loader.h"
+#include "melted_log.h"
+
+/** Job states.
+*/
+
+typedef enum
+{
+	melted_job_queued,
+	melted_job_opening,
+	melted_job_ready
+}
+melted_job_state;
+
+/** A clip waiting to be loaded.
+*/
+
+typedef struct melted_job_s
+{
+	int id;
+	melted_unit unit;
+	melted_loader_action action;
+	char *clip;
+	int index;
+	int32_t in;
+	int32_t out;
+	int flush;
+	mlt_producer producer;
+	melted_job_state state;
+	struct melted_job_s *next;
+	struct melted_job_s *order;
+}
+*melted_job, melted_job_t;
+
+/** The recorded state of a job.
+*/
+
+typedef struct
+{
+	melted_unit unit;
+	int id;
+	const char *state;
+}
+melted_job_outcome;
+
+/** The loader - jobs wait in the queue for a thread to open their producer
+	and stay in the order list until they are spliced, which happens in the
+	order they were submitted for each unit. The states of the most recent
+	jobs are kept in a ring indexed by job id.
+*/
+
+static struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int started;
+	int terminated;
+	int id;
+	pthread_t threads[ MELTED_LOADER_THREADS ];
+	melted_job queue;
+	melted_job *queue_tail;
+	melted_job order;
+	melted_job_outcome history[ MELTED_LOADER_HISTORY ];
+}
+loader = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/** Record the state of a job - replaces the job MELTED_LOADER_HISTORY jobs
+	before it. Must be called with the mutex held.
+*/
+
+static void melted_job_report( melted_job job, const char *state )
+{
+	melted_job_outcome *outcome = &loader.history[ job->id % MELTED_LOADER_HISTORY ];
+	outcome->unit = job->unit;
+	outcome->id = job->id;
+	outcome->state = state;
+}
+
+static void melted_job_close( melted_job job )
+{
+	if ( job->producer != NULL )
+		mlt_producer_close( job->producer );
+	free( job->clip );
+	free( job );
+}
+
+/** Splice a job into its unit's playlist.
+*/
+
+static void melted_job_splice( melted_job job )
+{
+	if ( job->producer == NULL )
+	{
+		melted_log( LOG_NOTICE, "job %d failed to load %s", job->id, job->clip );
+		melted_job_report( job, "failed" );
+		melted_unit_report_job( job->unit, job->id, job_failed );
+		return;
+	}
+
+	switch( job->action )
+	{
+		case melted_loader_load:
+			melted_unit_load_producer( job->unit, job->producer, job->in, job->out, job->flush );
+			break;
+		case melted_loader_insert:
+			melted_unit_insert_producer( job->unit, job->producer, job->index, job->in, job->out );
+			break;
+		case melted_loader_append:
+			melted_unit_append_producer( job->unit, job->producer, job->in, job->out );
+			break;
+	}
+
+	melted_log( LOG_DEBUG, "job %d loaded %s", job->id, job->clip );
+	melted_job_report( job, "ok" );
+	melted_unit_report_job( job->unit, job->id, job_ok );
+}
+
+/** Splice every ready job which has no earlier job for its unit still
+	waiting - must be called with the mutex held.
+*/
+
+static void melted_loader_splice( )
+{
+	melted_job *entry = &loader.order;
+
+	while ( *entry != NULL )
+	{
+		melted_job job = *entry;
+		melted_job earlier = loader.order;
+
+		while ( earlier != job && earlier->unit != job->unit )
+			earlier = earlier->order;
+
+		if ( job->state == melted_job_ready && earlier == job )
+		{
+			*entry = job->order;
+			melted_job_splice( job );
+			melted_job_close( job );
+		}
+		else
+		{
+			entry = &job->order;
+		}
+	}
+}
+
+static void *melted_loader_thread( void *arg )
+{
+	pthread_mutex_lock( &loader.mutex );
+	while ( !loader.terminated )
+	{
+		melted_job job = loader.queue;
+
+		if ( job == NULL )
+		{
+			pthread_cond_wait( &loader.cond, &loader.mutex );
+			continue;
+		}
+
+		loader.queue = job->next;
+		if ( loader.queue == NULL )
+			loader.queue_tail = &loader.queue;
+		job->state = melted_job_opening;
+		pthread_mutex_unlock( &loader.mutex );
+
+		job->producer = melted_unit_locate( job->unit, job->clip );
+
+		pthread_mutex_lock( &loader.mutex );
+		job->state = melted_job_ready;
+		melted_loader_splice( );
+
+		/* Wakes anyone cancelling the unit's jobs too */
+		pthread_cond_broadcast( &loader.cond );
+	}
+	pthread_mutex_unlock( &loader.mutex );
+
+	return NULL;
+}
+
+/** Queue a clip to be opened and spliced into a unit's playlist. Returns the
+	job id, or -1 if the job couldn't be queued.
+*/
+
+int melted_loader_submit( melted_unit unit, melted_loader_action action, char *clip, int index, int32_t in, int32_t out, int flush )
+{
+	melted_job job = calloc( 1, sizeof( melted_job_t ) );
+	melted_job *entry = NULL;
+	int id = -1;
+
+	if ( job == NULL || ( job->clip = strdup( clip ) ) == NULL )
+	{
+		free( job );
+		return -1;
+	}
+
+	job->unit = unit;
+	job->action = action;
+	job->index = index;
+	job->in = in;
+	job->out = out;
+	job->flush = flush;
+
+	pthread_mutex_lock( &loader.mutex );
+
+	while ( loader.started < MELTED_LOADER_THREADS && !loader.terminated )
+	{
+		if ( pthread_create( &loader.threads[ loader.started ], NULL, melted_loader_thread, NULL ) )
+			break;
+		loader.started ++;
+	}
+
+	if ( loader.started > 0 && !loader.terminated )
+	{
+		id = job->id = ++ loader.id;
+		melted_job_report( job, "pending" );
+
+		if ( loader.queue == NULL )
+			loader.queue_tail = &loader.queue;
+		*loader.queue_tail = job;
+		loader.queue_tail = &job->next;
+
+		for ( entry = &loader.order; *entry != NULL; entry = &( *entry )->order )
+			;
+		*entry = job;
+
+		pthread_cond_broadcast( &loader.cond );
+	}
+
+	pthread_mutex_unlock( &loader.mutex );
+
+	if ( id == -1 )
+		melted_job_close( job );
+
+	return id;
+}
+
+/** Get the state of a recent job on a unit (pending, ok or failed), or NULL
+	if the job isn't known or too many jobs have been submitted since.
+*/
+
+const char *melted_loader_state( melted_unit unit, int id )
+{
+	const char *state = NULL;
+
+	pthread_mutex_lock( &loader.mutex );
+	if ( id > 0 )
+	{
+		melted_job_outcome *outcome = &loader.history[ id % MELTED_LOADER_HISTORY ];
+		if ( outcome->unit == unit && outcome->id == id )
+			state = outcome->state;
+	}
+	pthread_mutex_unlock( &loader.mutex );
+
+	return state;
+}
+
+/** Drop the jobs for a unit which is going away - waits for any of them
+	which are being opened, as opening uses the unit.
+*/
+
+void melted_loader_cancel( melted_unit unit )
+{
+	int opening = 1;
+	int index = 0;
+
+	pthread_mutex_lock( &loader.mutex );
+	while ( opening )
+	{
+		melted_job *entry = &loader.queue;
+
+		opening = 0;
+
+		loader.queue_tail = &loader.queue;
+		while ( *entry != NULL )
+		{
+			if ( ( *entry )->unit == unit )
+				*entry = ( *entry )->next;
+			else
+				entry = &( *entry )->next;
+		}
+		loader.queue_tail = entry;
+
+		entry = &loader.order;
+		while ( *entry != NULL )
+		{
+			melted_job job = *entry;
+			if ( job->unit == unit && job->state != melted_job_opening )
+			{
+				*entry = job->order;
+				melted_job_close( job );
+			}
+			else
+			{
+				opening |= job->unit == unit;
+				entry = &job->order;
+			}
+		}
+
+		if ( opening )
+			pthread_cond_wait( &loader.cond, &loader.mutex );
+	}
+
+	for ( index = 0; index < MELTED_LOADER_HISTORY; index ++ )
+		if ( loader.history[ index ].unit == unit )
+			loader.history[ index ].unit = NULL;
+	pthread_mutex_unlock( &loader.mutex );
+}
+
+/** Stop the loader threads and drop any jobs which are left.
+*/
+
+void melted_loader_close( )
+{
+	int index = 0;
+
+	pthread_mutex_lock( &loader.mutex );
+	loader.terminated = 1;
+	pthread_cond_broadcast( &loader.cond );
+	pthread_mutex_unlock( &loader.mutex );
+
+	for ( index = 0; index < loader.started; index ++ )
+		pthread_join( loader.threads[ index ], NULL );
+	loader.started = 0;
+
+	while ( loader.order != NULL )
+	{
+		melted_job job = loader.order;
+		loader.order = job->order;
+		melted_job_close( job );
+	}
+	loader.queue = NULL;
+	loader.queue_tail = &loader.queue;
+	loader.terminated = 0;
+}
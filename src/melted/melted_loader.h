@@ -0,0 +1,61 @@
+/*
+ * melted_loader.h -- Asynchronous Clip Loading
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_LOADER_H_
+#define _MELTED_LOADER_H_
+
+/* Application header files */
+#include "melted_unit.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Number of threads opening producers.
+*/
+
+#define MELTED_LOADER_THREADS 4
+
+/** Number of recent jobs whose outcome is kept for UGET job.{number}.
+*/
+
+#define MELTED_LOADER_HISTORY 256
+
+/** How a loaded clip is spliced into the unit's playlist.
+*/
+
+typedef enum
+{
+	melted_loader_load,
+	melted_loader_insert,
+	melted_loader_append
+}
+melted_loader_action;
+
+extern int melted_loader_submit( melted_unit, melted_loader_action, char *, int, int32_t, int32_t, int );
+extern const char *melted_loader_state( melted_unit, int );
+extern void melted_loader_cancel( melted_unit );
+extern void melted_loader_close( );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
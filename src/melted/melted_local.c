@@ -25,7 +25,10 @@
 /* System header files */
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <signal.h>
+#include <pthread.h>
 
 /* Needed for backtrace on linux */
 #ifdef linux
@@ -156,6 +159,9 @@ typedef struct
 	int type;
 /* online help information */
 	const char *help;
+/* handler and its object for commands registered by extensions */
+	melted_command handler;
+	void *object;
 } 
 command_t;
 
@@ -176,6 +182,7 @@ static command_t vocabulary[] =
 	{"CLS", melted_list_clips, 0, ATYPE_STRING, "Lists the clips at directory name argument."},
 	{"SET", melted_set_global_property, 0, ATYPE_PAIR, "Set a server configuration property."},
 	{"GET", melted_get_global_property, 0, ATYPE_STRING, "Get a server configuration property."},
+	{"CACHE", melted_cache, 0, ATYPE_NONE, "Report producer cache statistics, CLEAR the cache or set its SIZE."},
 	{"RUN", melted_run, 0, ATYPE_STRING, "Run a batch file." },
 	{"LIST", melted_list, 1, ATYPE_NONE, "List the playlist associated to a unit."},
 	{"LOAD", melted_load, 1, ATYPE_STRING, "Load clip specified in absolute filename argument."},
@@ -203,6 +210,197 @@ static command_t vocabulary[] =
 	{NULL, NULL, 0, ATYPE_NONE, NULL}
 };
 
+/** Commands registered by extensions, oldest first.
+*/
+
+typedef struct command_entry_s
+{
+	command_t command;
+	struct command_entry_s *next;
+}
+command_entry_t;
+
+/** Hash table for the command lookup - open addressing on the case folded
+	command, rebuilt whenever an extension registers or removes commands.
+*/
+
+static struct
+{
+	pthread_rwlock_t lock;
+	command_t **slots;
+	unsigned int mask;
+	command_entry_t *registered;
+}
+commands = { PTHREAD_RWLOCK_INITIALIZER, NULL, 0, NULL };
+
+static pthread_once_t commands_once = PTHREAD_ONCE_INIT;
+
+static unsigned int command_hash( const char *name )
+{
+	unsigned int hash = 2166136261u;
+	while ( *name )
+		hash = ( hash ^ ( unsigned char )toupper( ( unsigned char )*name ++ ) ) * 16777619u;
+	return hash;
+}
+
+/** Insert into the table, replacing an existing command of the same name.
+*/
+
+static void command_insert( command_t **slots, unsigned int mask, command_t *command )
+{
+	unsigned int index = command_hash( command->command ) & mask;
+	while ( slots[ index ] != NULL && strcasecmp( slots[ index ]->command, command->command ) )
+		index = ( index + 1 ) & mask;
+	slots[ index ] = command;
+}
+
+/** Rebuild the table from the vocabulary and the registered commands - must
+	be called with the write lock held (or before any lookups happen).
+*/
+
+static int command_rebuild( )
+{
+	int count = 0;
+	unsigned int size = 64;
+	command_t **slots = NULL;
+	command_entry_t *entry = NULL;
+	int index = 0;
+
+	for ( index = 1; vocabulary[ index ].command != NULL; index ++ )
+		count ++;
+	for ( entry = commands.registered; entry != NULL; entry = entry->next )
+		count ++;
+
+	/* Keep the table at most half full */
+	while ( size < count * 2 )
+		size *= 2;
+
+	slots = calloc( size, sizeof( command_t * ) );
+	if ( slots == NULL )
+		return -1;
+
+	/* BYE is handled by the connection and never reaches the parser */
+	for ( index = 1; vocabulary[ index ].command != NULL; index ++ )
+		command_insert( slots, size - 1, &vocabulary[ index ] );
+
+	/* Registered commands follow so they can replace built in ones */
+	for ( entry = commands.registered; entry != NULL; entry = entry->next )
+		command_insert( slots, size - 1, &entry->command );
+
+	free( commands.slots );
+	commands.slots = slots;
+	commands.mask = size - 1;
+	return 0;
+}
+
+static void command_init( )
+{
+	command_rebuild( );
+}
+
+/** Find the definition of a command.
+*/
+
+static int command_lookup( const char *name, command_t *result )
+{
+	int found = 0;
+
+	pthread_once( &commands_once, command_init );
+	pthread_rwlock_rdlock( &commands.lock );
+	if ( commands.slots != NULL )
+	{
+		unsigned int index = command_hash( name ) & commands.mask;
+		while ( !found && commands.slots[ index ] != NULL )
+		{
+			if ( ( found = !strcasecmp( commands.slots[ index ]->command, name ) ) )
+				*result = *commands.slots[ index ];
+			index = ( index + 1 ) & commands.mask;
+		}
+	}
+	pthread_rwlock_unlock( &commands.lock );
+
+	return found;
+}
+
+/** Register a command. The handler is called with the object and the full
+	command line and returns the response. A command of the same name, built
+	in or registered earlier, is replaced.
+*/
+
+int melted_local_register_command( const char *name, melted_command handler, void *object, const char *help )
+{
+	int error = -1;
+	command_entry_t *entry = calloc( 1, sizeof( command_entry_t ) );
+
+	if ( entry != NULL && name != NULL && handler != NULL && strchr( name, ' ' ) == NULL )
+	{
+		command_entry_t **tail = &commands.registered;
+
+		entry->command.command = strdup( name );
+		entry->command.help = strdup( help != NULL ? help : "" );
+		entry->command.type = ATYPE_NONE;
+		entry->command.handler = handler;
+		entry->command.object = object;
+
+		pthread_once( &commands_once, command_init );
+		pthread_rwlock_wrlock( &commands.lock );
+		while ( *tail != NULL )
+			tail = &( *tail )->next;
+		*tail = entry;
+		error = command_rebuild( );
+		if ( error )
+			*tail = NULL;
+		pthread_rwlock_unlock( &commands.lock );
+	}
+
+	if ( error && entry != NULL )
+	{
+		free( ( char * )entry->command.command );
+		free( ( char * )entry->command.help );
+		free( entry );
+	}
+
+	return error;
+}
+
+/** Remove all commands registered with the given object.
+*/
+
+void melted_local_unregister_commands( void *object )
+{
+	command_entry_t **entry = &commands.registered;
+	command_entry_t *removed = NULL;
+
+	pthread_once( &commands_once, command_init );
+	pthread_rwlock_wrlock( &commands.lock );
+	while ( *entry != NULL )
+	{
+		if ( ( *entry )->command.object == object )
+		{
+			command_entry_t *next = ( *entry )->next;
+			( *entry )->next = removed;
+			removed = *entry;
+			*entry = next;
+		}
+		else
+		{
+			entry = &( *entry )->next;
+		}
+	}
+	if ( removed != NULL )
+		command_rebuild( );
+	pthread_rwlock_unlock( &commands.lock );
+
+	while ( removed != NULL )
+	{
+		command_entry_t *next = removed->next;
+		free( ( char * )removed->command.command );
+		free( ( char * )removed->command.help );
+		free( removed );
+		removed = next;
+	}
+}
+
 /** Usage message 
 */
 
@@ -230,6 +428,7 @@ inline const char *get_response_msg( int code )
 response_codes melted_help( command_argument cmd_arg )
 {
 	int i = 0;
+	command_entry_t *entry = NULL;
 	
 	mvcp_response_printf( cmd_arg->response, 10240, "%s", helpstr );
 	
@@ -239,6 +438,14 @@ response_codes melted_help( command_argument cmd_arg )
 							vocabulary[ i ].command, 
 							vocabulary[ i ].help );
 
+	pthread_rwlock_rdlock( &commands.lock );
+	for ( entry = commands.registered; entry != NULL; entry = entry->next )
+		mvcp_response_printf( cmd_arg->response, 1024,
+							"%-10.10s%s\n", 
+							entry->command.command, 
+							entry->command.help );
+	pthread_rwlock_unlock( &commands.lock );
+
 	mvcp_response_printf( cmd_arg->response, 2, "\n" );
 
 	return RESPONSE_SUCCESS_N;
@@ -454,24 +661,34 @@ static mvcp_response melted_local_execute( melted_local local, char *command )
 		int index = 0;
 		char *value = mvcp_tokeniser_get_string( cmd.tokeniser, 0 );
 		int found = 0;
+		command_t definition;
 
 		/* Strip quotes from all tokens */
 		for ( index = 0; index < mvcp_tokeniser_count( cmd.tokeniser ); index ++ )
 			mvcp_util_strip( mvcp_tokeniser_get_string( cmd.tokeniser, index ), '\"' );
 
-		/* Search the vocabulary array for value */
-		for ( index = 1; !found && vocabulary[ index ].command != NULL; index ++ )
-			if ( ( found = !strcasecmp( vocabulary[ index ].command, value ) ) )
-				break;
+		/* Look up the command */
+		found = command_lookup( value, &definition );
+
+		/* Commands registered by extensions produce their own response */
+		if ( found && definition.handler != NULL )
+		{
+			mvcp_response response = definition.handler( definition.object, command );
+			if ( response != NULL )
+			{
+				mvcp_response_close( cmd.response );
+				cmd.response = response;
+			}
+		}
 
-		/* If we found something, the handle the args and call the handler. */
-		if ( found )
+		/* Otherwise handle the args and call the handler. */
+		else if ( found )
 		{
 			int position = 1;
 
 			melted_command_set_error( &cmd, RESPONSE_SUCCESS );
 
-			if ( vocabulary[ index ].is_unit )
+			if ( definition.is_unit )
 			{
 				cmd.unit = melted_command_parse_unit( &cmd, position );
 				if ( cmd.unit == -1 )
@@ -481,15 +698,15 @@ static mvcp_response melted_local_execute( melted_local local, char *command )
 
 			if ( melted_command_get_error( &cmd ) == RESPONSE_SUCCESS )
 			{
-				cmd.argument = melted_command_parse_argument( &cmd, position, vocabulary[ index ].type, command );
-				if ( cmd.argument == NULL && vocabulary[ index ].type != ATYPE_NONE )
+				cmd.argument = melted_command_parse_argument( &cmd, position, definition.type, command );
+				if ( cmd.argument == NULL && definition.type != ATYPE_NONE )
 					melted_command_set_error( &cmd, RESPONSE_MISSING_ARG );
 				position ++;
 			}
 
 			if ( melted_command_get_error( &cmd ) == RESPONSE_SUCCESS )
 			{
-				response_codes error = vocabulary[ index ].operation( &cmd );
+				response_codes error = definition.operation( &cmd );
 				melted_command_set_error( &cmd, error );
 			}
 
@@ -531,8 +748,16 @@ static mvcp_response melted_local_receive( melted_local local, char *command, ch
 			melted_command_set_error( &cmd, RESPONSE_MISSING_ARG );
 		position ++;
 
-		melted_receive( &cmd, doc );
-		melted_command_set_error( &cmd, RESPONSE_SUCCESS );
+		if ( !strcasecmp( mvcp_tokeniser_get_string( cmd.tokeniser, 0 ), "BATCH" ) )
+		{
+			if ( melted_command_get_error( &cmd ) == RESPONSE_SUCCESS )
+				melted_command_set_error( &cmd, melted_batch( &cmd, doc ) );
+		}
+		else
+		{
+			melted_receive( &cmd, doc );
+			melted_command_set_error( &cmd, RESPONSE_SUCCESS );
+		}
 
 		free( cmd.argument );
 	}
@@ -29,10 +29,18 @@ extern "C"
 {
 #endif
 
+/** Handler for a command registered by an extension. It receives the object
+	given at registration and the full command line.
+*/
+
+typedef mvcp_response (*melted_command)( void *, char * );
+
 /** Local parser API.
 */
 
 extern mvcp_parser melted_parser_init_local( );
+extern int melted_local_register_command( const char *, melted_command, void *, const char * );
+extern void melted_local_unregister_commands( void * );
 
 #ifdef __cplusplus
 }
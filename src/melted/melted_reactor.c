@@ -0,0 +1,762 @@
+/*
+ * melted_reactor.c -- Event Driven Connection Handler
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* Application header files */
+#include "melted_reactor.h"
+#include "melted_connection.h"
+#include "melted_log.h"
+#include <mvcp/mvcp_reader.h>
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
+/** Size of the per connection input buffer.
+*/
+
+#define REACTOR_INPUT_SIZE 8192
+
+/** Longest command line accepted - matches the limit used by parser_thread.
+*/
+
+#define REACTOR_LINE_SIZE 1024
+
+/** Pending output at which we stop reading from a client until it catches up.
+*/
+
+#define REACTOR_OUTPUT_LIMIT ( 1024 * 1024 )
+
+/** Maximum number of events handled per epoll_wait.
+*/
+
+#define REACTOR_EVENTS 64
+
+/** Connection states.
+*/
+
+typedef enum
+{
+	reactor_command,
+	reactor_push_size,
+	reactor_push_body,
+	reactor_push_chunk_size,
+	reactor_push_chunk
+}
+reactor_state;
+
+typedef struct reactor_thread_s *reactor_thread;
+typedef struct reactor_connection_s *reactor_connection;
+
+/** Connection as seen by the reactor.
+*/
+
+struct reactor_connection_s
+{
+	connection_t base;
+	reactor_thread thread;
+	reactor_state state;
+	int events;
+	mvcp_reader reader;
+	char *output;
+	int output_used;
+	int output_sent;
+	int output_size;
+	char command[ REACTOR_LINE_SIZE ];
+	char *push;
+	int push_size;
+	int push_used;
+	connection_spool_t spool;
+	int closing;
+	connection_subscriber watch;
+	reactor_connection next;
+	reactor_connection prev;
+};
+
+/** I/O thread - each owns its own epoll set and the connections it accepted.
+*/
+
+struct reactor_thread_s
+{
+	melted_server server;
+	pthread_t thread;
+	int epoll;
+	reactor_connection connections;
+	int pipe[ 2 ];
+	mvcp_notifier notifier;
+	mvcp_notifier_watch watch;
+	int watching;
+};
+
+/** Append data to the output buffer of the connection (used as a connection_emitter).
+*/
+
+static int reactor_emit( void *arg, const char *data, int length )
+{
+	reactor_connection this = arg;
+	if ( this->output_used + length > this->output_size )
+	{
+		int size = this->output_size == 0 ? 4096 : this->output_size;
+		char *output = NULL;
+		while ( size < this->output_used + length )
+			size *= 2;
+		output = realloc( this->output, size );
+		if ( output == NULL )
+			return -1;
+		this->output = output;
+		this->output_size = size;
+	}
+	memcpy( this->output + this->output_used, data, length );
+	this->output_used += length;
+	return 0;
+}
+
+/** Queue a response for the connection and release it.
+*/
+
+static void reactor_respond( reactor_connection this, mvcp_response response )
+{
+	connection_format( response, reactor_emit, this );
+	mvcp_response_close( response );
+}
+
+/** Amount of output waiting to be sent.
+*/
+
+static int reactor_pending( reactor_connection this )
+{
+	return this->output_used - this->output_sent;
+}
+
+/** Send as much pending output as the socket will accept.
+*/
+
+static int reactor_flush( reactor_connection this )
+{
+	while ( reactor_pending( this ) > 0 )
+	{
+		ssize_t count = send( this->base.fd, this->output + this->output_sent, reactor_pending( this ), MSG_NOSIGNAL );
+		if ( count > 0 )
+			this->output_sent += count;
+		else if ( count < 0 && errno == EINTR )
+			continue;
+		else if ( count < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+			break;
+		else
+			return -1;
+	}
+	if ( this->output_sent == this->output_used )
+		this->output_sent = this->output_used = 0;
+	return 0;
+}
+
+/** Bring the epoll registration in line with what the connection is waiting for.
+*/
+
+static void reactor_update( reactor_connection this )
+{
+	int events = 0;
+	if ( reactor_pending( this ) < REACTOR_OUTPUT_LIMIT && !this->closing && !this->reader->eof )
+		events |= EPOLLIN;
+	if ( reactor_pending( this ) > 0 )
+		events |= EPOLLOUT;
+	if ( events != this->events )
+	{
+		struct epoll_event event;
+		memset( &event, 0, sizeof( event ) );
+		event.events = events;
+		event.data.ptr = this;
+		epoll_ctl( this->thread->epoll, EPOLL_CTL_MOD, this->base.fd, &event );
+		this->events = events;
+	}
+}
+
+/** Remove the connection from its thread without closing the socket.
+*/
+
+static void reactor_detach( reactor_connection this )
+{
+	reactor_thread thread = this->thread;
+	epoll_ctl( thread->epoll, EPOLL_CTL_DEL, this->base.fd, NULL );
+	if ( this->watch != NULL )
+		thread->watching --;
+	if ( this->prev != NULL )
+		this->prev->next = this->next;
+	else
+		thread->connections = this->next;
+	if ( this->next != NULL )
+		this->next->prev = this->prev;
+	this->next = this->prev = NULL;
+}
+
+static void reactor_free( reactor_connection this )
+{
+	connection_unsubscribe( this->watch );
+	mvcp_reader_close( this->reader );
+	free( this->output );
+	free( this->push );
+	if ( this->state == reactor_push_chunk_size || this->state == reactor_push_chunk )
+		connection_spool_close( &this->spool );
+	free( this );
+}
+
+/** Close the connection and release its resources.
+*/
+
+static void reactor_close( reactor_connection this )
+{
+	reactor_detach( this );
+	close( this->base.fd );
+	melted_log( LOG_NOTICE, "Connection with %s (%d) closed", this->base.address, this->base.fd );
+	reactor_free( this );
+}
+
+/** Status thread - STATUS holds a connection for the rest of its life, so it
+	is handed off to a thread of its own as in the threaded server.
+*/
+
+static void *reactor_status_thread( void *arg )
+{
+	reactor_connection this = arg;
+	int fd = this->base.fd;
+	int flags = fcntl( fd, F_GETFL );
+	int error = 0;
+
+	fcntl( fd, F_SETFL, flags & ~O_NONBLOCK );
+	while ( !error && reactor_pending( this ) > 0 )
+	{
+		ssize_t count = send( fd, this->output + this->output_sent, reactor_pending( this ), MSG_NOSIGNAL );
+		if ( count > 0 )
+			this->output_sent += count;
+		else if ( count < 0 && errno == EINTR )
+			continue;
+		else
+			error = 1;
+	}
+
+	if ( !error )
+		connection_status( fd, mvcp_parser_get_notifier( this->base.parser ), this->command );
+
+	close( fd );
+
+	melted_log( LOG_NOTICE, "Connection with %s (%d) closed", this->base.address, fd );
+	reactor_free( this );
+	return NULL;
+}
+
+static int reactor_status( reactor_connection this )
+{
+	pthread_t thread;
+	pthread_attr_t attributes;
+	int error = 0;
+
+	reactor_detach( this );
+	pthread_attr_init( &attributes );
+	pthread_attr_setdetachstate( &attributes, PTHREAD_CREATE_DETACHED );
+	error = pthread_create( &thread, &attributes, reactor_status_thread, this );
+	pthread_attr_destroy( &attributes );
+
+	if ( error )
+	{
+		melted_log( LOG_ERR, "Failed to start status thread for %s", this->base.address );
+		close( this->base.fd );
+		reactor_free( this );
+	}
+	return error;
+}
+
+/** Register the thread with the notifier so that it is woken by status events.
+*/
+
+static int reactor_watch_init( reactor_thread thread, mvcp_notifier notifier )
+{
+	if ( thread->watch == NULL && pipe( thread->pipe ) == 0 )
+	{
+		struct epoll_event event;
+		fcntl( thread->pipe[ 0 ], F_SETFL, O_NONBLOCK );
+		fcntl( thread->pipe[ 1 ], F_SETFL, O_NONBLOCK );
+		memset( &event, 0, sizeof( event ) );
+		event.events = EPOLLIN;
+		event.data.ptr = thread;
+		if ( epoll_ctl( thread->epoll, EPOLL_CTL_ADD, thread->pipe[ 0 ], &event ) == 0 )
+		{
+			thread->notifier = notifier;
+			thread->watch = mvcp_notifier_watch_init( notifier, thread->pipe[ 1 ] );
+		}
+		if ( thread->watch == NULL )
+		{
+			close( thread->pipe[ 0 ] );
+			close( thread->pipe[ 1 ] );
+		}
+	}
+	return thread->watch == NULL;
+}
+
+/** Start (WATCH) or stop (UNWATCH) interleaving status with the responses.
+	The status lines are sent by reactor_pump between responses.
+*/
+
+static mvcp_response reactor_watch( reactor_connection this, char *line )
+{
+	mvcp_response response = mvcp_response_init( );
+	mvcp_notifier notifier = mvcp_parser_get_notifier( this->base.parser );
+
+	if ( this->watch != NULL )
+	{
+		connection_unsubscribe( this->watch );
+		this->watch = NULL;
+		this->thread->watching --;
+	}
+
+	if ( !strncasecmp( line, "WATCH", 5 ) )
+	{
+		if ( reactor_watch_init( this->thread, notifier ) == 0 )
+			this->watch = connection_subscribe( notifier, line, "* ", reactor_emit, this );
+		if ( this->watch != NULL )
+			this->thread->watching ++;
+		else
+			mvcp_response_set_error( response, RESPONSE_ERROR, "Unable to watch" );
+	}
+
+	if ( mvcp_response_count( response ) == 0 )
+		mvcp_response_set_error( response, RESPONSE_SUCCESS, "OK" );
+
+	melted_log( LOG_INFO, "%s \"%s\" %d", this->base.address, line, mvcp_response_get_error_code( response ) );
+	return response;
+}
+
+/** Handle a complete line. Returns 0 to carry on, 1 when the connection has
+	been handed off and -1 when it should be closed at once. BYE marks the
+	connection as closing instead, so the responses still queued are sent.
+*/
+
+static int reactor_line( reactor_connection this, char *line )
+{
+	char *cr = strchr( line, '\r' );
+	if ( cr != NULL )
+		cr[ 0 ] = '\0';
+
+	if ( this->state == reactor_push_size && !strcmp( line, "chunked" ) )
+	{
+		// The body follows as chunks, each preceded by its size in hex
+		connection_spool_open( &this->spool );
+		this->state = reactor_push_chunk_size;
+	}
+	else if ( this->state == reactor_push_chunk_size )
+	{
+		if ( connection_spool_size( &this->spool, line ) )
+			return -1;
+		if ( this->spool.done )
+		{
+			reactor_respond( this, connection_push_spool( &this->base, this->command, &this->spool ) );
+			this->state = reactor_command;
+		}
+		else
+		{
+			this->state = reactor_push_chunk;
+		}
+	}
+	else if ( this->state == reactor_push_size )
+	{
+		this->push_size = atoi( line );
+		this->push_used = 0;
+		if ( this->push_size > 0 )
+		{
+			this->push = malloc( this->push_size + 1 );
+			if ( this->push == NULL )
+				return -1;
+			this->state = reactor_push_body;
+		}
+		else
+		{
+			reactor_respond( this, connection_push( &this->base, this->command, "", 0 ) );
+			this->state = reactor_command;
+		}
+	}
+	else if ( strncasecmp( line, "BYE", 3 ) == 0 )
+	{
+		this->closing = 1;
+	}
+	else if ( !strcmp( line, "" ) )
+	{
+		// Ignore blank lines
+	}
+	else if ( !strncmp( line, "PUSH ", 5 ) || !strncmp( line, "BATCH ", 6 ) )
+	{
+		strcpy( this->command, line );
+		this->state = reactor_push_size;
+	}
+	else if ( !strncasecmp( line, "WATCH", 5 ) || !strncasecmp( line, "UNWATCH", 7 ) )
+	{
+		reactor_respond( this, reactor_watch( this, line ) );
+	}
+	else if ( strncmp( line, "STATUS", 6 ) )
+	{
+		reactor_respond( this, connection_execute( &this->base, line ) );
+	}
+	else
+	{
+		strcpy( this->command, line );
+		reactor_status( this );
+		return 1;
+	}
+	return 0;
+}
+
+/** Process as much of the buffered input as possible.
+*/
+
+static int reactor_process( reactor_connection this )
+{
+	int result = 0;
+
+	while ( result == 0 && !this->closing && mvcp_reader_available( this->reader ) > 0 && reactor_pending( this ) < REACTOR_OUTPUT_LIMIT )
+	{
+		if ( this->state == reactor_push_body )
+		{
+			this->push_used += mvcp_reader_drain( this->reader, this->push + this->push_used, this->push_size - this->push_used );
+			if ( this->push_used == this->push_size )
+			{
+				this->push[ this->push_size ] = '\0';
+				reactor_respond( this, connection_push( &this->base, this->command, this->push, this->push_size ) );
+				free( this->push );
+				this->push = NULL;
+				this->state = reactor_command;
+			}
+		}
+		else if ( this->state == reactor_push_chunk )
+		{
+			char chunk[ 16384 ];
+			int length = mvcp_reader_drain( this->reader, chunk, this->spool.remaining < sizeof( chunk ) ? this->spool.remaining : sizeof( chunk ) );
+			connection_spool_write( &this->spool, chunk, length );
+			if ( this->spool.remaining == 0 )
+				this->state = reactor_push_chunk_size;
+		}
+		else
+		{
+			char line[ REACTOR_LINE_SIZE ];
+			int eof = 0;
+			if ( !mvcp_reader_scan( this->reader, line, this->state == reactor_push_size || this->state == reactor_push_chunk_size ? 20 : REACTOR_LINE_SIZE, &eof ) )
+				break;
+			/* An incomplete last line (or a ctrl-D) ends the input, as in the threaded server */
+			if ( eof )
+				this->closing = 1;
+			else
+				result = reactor_line( this, line );
+		}
+	}
+
+	return result;
+}
+
+/** Handle the events reported for a connection.
+*/
+
+static void reactor_event( reactor_connection this, int events )
+{
+	int result = 0;
+
+	if ( events & EPOLLIN )
+	{
+		/* Commands received before the client closed its side are still answered */
+		mvcp_reader_fill( this->reader );
+	}
+	else if ( events & ( EPOLLERR | EPOLLHUP ) )
+	{
+		result = -1;
+	}
+
+	/* Commands held back by a full output buffer are picked up here too */
+	if ( result == 0 )
+		result = reactor_process( this );
+
+	if ( result == 0 && reactor_flush( this ) )
+		result = -1;
+
+	if ( result == 0 && reactor_pending( this ) < REACTOR_OUTPUT_LIMIT && mvcp_reader_available( this->reader ) > 0 )
+	{
+		result = reactor_process( this );
+		if ( result == 0 && reactor_flush( this ) )
+			result = -1;
+	}
+
+	/* Nothing more arrives at end of file, so everything left is handled now */
+	while ( result == 0 && this->reader->eof && !this->closing && reactor_pending( this ) == 0 && mvcp_reader_available( this->reader ) > 0 )
+	{
+		result = reactor_process( this );
+		if ( result == 0 && reactor_flush( this ) )
+			result = -1;
+	}
+
+	/* A closing connection goes once everything queued for it has been sent */
+	if ( result == 0 && reactor_pending( this ) == 0 && ( this->closing || ( this->reader->eof && mvcp_reader_available( this->reader ) == 0 ) ) )
+		result = -1;
+
+	if ( result == 0 )
+		reactor_update( this );
+	else if ( result < 0 )
+		reactor_close( this );
+}
+
+/** Send the status events waiting for the watching connections of the thread.
+	Returns the milliseconds until it needs to be called again.
+*/
+
+static int reactor_pump( reactor_thread thread )
+{
+	reactor_connection this = NULL;
+	reactor_connection next = NULL;
+	int timeout = 1000;
+
+	if ( thread->watching == 0 )
+		return timeout;
+
+	/* Arming first means nothing put while we catch up is missed */
+	mvcp_notifier_watch_arm( thread->notifier, thread->watch );
+
+	for ( this = thread->connections; this != NULL; this = next )
+	{
+		next = this->next;
+		/* A client which isn't reading falls behind and is sent everything when it catches up */
+		if ( this->watch != NULL && reactor_pending( this ) < REACTOR_OUTPUT_LIMIT )
+		{
+			int due = connection_subscriber_pump( this->watch, timeout );
+			if ( due < 0 || reactor_flush( this ) )
+			{
+				reactor_close( this );
+			}
+			else
+			{
+				reactor_update( this );
+				if ( due < timeout )
+					timeout = due;
+			}
+		}
+	}
+
+	return timeout;
+}
+
+/** Accept all pending connections on the listening socket.
+*/
+
+static void reactor_accept( reactor_thread thread )
+{
+	melted_server server = thread->server;
+
+	while ( 1 )
+	{
+		struct epoll_event event;
+		reactor_connection this = NULL;
+		struct sockaddr_in sin;
+		socklen_t socksize = sizeof( sin );
+		int fd = accept( server->socket, ( struct sockaddr * )&sin, &socksize );
+
+		if ( fd == -1 )
+		{
+			if ( errno == EMFILE || errno == ENFILE )
+				melted_log( LOG_ERR, "%s unable to accept connection: %s", server->id, strerror( errno ) );
+			break;
+		}
+
+		this = calloc( 1, sizeof( struct reactor_connection_s ) );
+		if ( this != NULL )
+			this->reader = mvcp_reader_init( fd, REACTOR_INPUT_SIZE );
+		if ( this == NULL || this->reader == NULL )
+		{
+			close( fd );
+			free( this );
+			break;
+		}
+
+		fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+
+		this->base.owner = &server->parent;
+		this->base.parser = server->parser;
+		this->base.fd = fd;
+		this->base.sin = sin;
+		this->thread = thread;
+		this->state = reactor_command;
+
+		/* A reverse lookup would stall every client on this thread */
+		connection_resolve( &this->base, 1 );
+
+		memset( &event, 0, sizeof( event ) );
+		event.events = this->events = EPOLLIN;
+		event.data.ptr = this;
+		if ( epoll_ctl( thread->epoll, EPOLL_CTL_ADD, fd, &event ) != 0 )
+		{
+			close( fd );
+			reactor_free( this );
+			continue;
+		}
+
+		this->next = thread->connections;
+		if ( this->next != NULL )
+			this->next->prev = this;
+		thread->connections = this;
+
+		melted_log( LOG_NOTICE, "Connection established with %s (%d)", this->base.address, fd );
+
+		/* Send the greeting */
+		{
+			mvcp_response response = mvcp_response_init( );
+			mvcp_response_set_error( response, 100, "VTR Ready" );
+			reactor_respond( this, response );
+		}
+		if ( reactor_flush( this ) )
+			reactor_close( this );
+		else
+			reactor_update( this );
+	}
+}
+
+/** I/O thread.
+*/
+
+static void *reactor_run( void *arg )
+{
+	reactor_thread thread = arg;
+	melted_server server = thread->server;
+	struct epoll_event events[ REACTOR_EVENTS ];
+	int timeout = 1000;
+
+	while ( !server->shutdown )
+	{
+		int count = epoll_wait( thread->epoll, events, REACTOR_EVENTS, timeout );
+		int index = 0;
+
+		for ( index = 0; index < count; index ++ )
+		{
+			if ( events[ index ].data.ptr == NULL )
+			{
+				reactor_accept( thread );
+			}
+			else if ( events[ index ].data.ptr == thread )
+			{
+				char drain[ 64 ];
+				while ( read( thread->pipe[ 0 ], drain, sizeof( drain ) ) > 0 ) ;
+			}
+			else
+			{
+				reactor_event( events[ index ].data.ptr, events[ index ].events );
+			}
+		}
+
+		timeout = reactor_pump( thread );
+	}
+
+	while ( thread->connections != NULL )
+		reactor_close( thread->connections );
+
+	if ( thread->watch != NULL )
+	{
+		mvcp_notifier_watch_close( thread->notifier, thread->watch );
+		close( thread->pipe[ 0 ] );
+		close( thread->pipe[ 1 ] );
+	}
+
+	return NULL;
+}
+
+int melted_reactor_available( )
+{
+	return 1;
+}
+
+/** Run the reactor with the requested number of I/O threads until the server
+	is shut down.
+*/
+
+int melted_reactor_run( melted_server server, int threads )
+{
+	struct reactor_thread_s thread[ MELTED_REACTOR_MAX_THREADS ];
+	int started = 0;
+	int index = 0;
+
+	if ( threads > MELTED_REACTOR_MAX_THREADS )
+		threads = MELTED_REACTOR_MAX_THREADS;
+
+	for ( index = 0; index < threads; index ++ )
+	{
+		struct epoll_event event;
+
+		memset( &thread[ index ], 0, sizeof( struct reactor_thread_s ) );
+		thread[ index ].server = server;
+		thread[ index ].epoll = epoll_create( REACTOR_EVENTS );
+		if ( thread[ index ].epoll == -1 )
+			break;
+
+		/* Each thread watches the listening socket, only one is woken per connection */
+		memset( &event, 0, sizeof( event ) );
+		event.events = EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.ptr = NULL;
+		if ( epoll_ctl( thread[ index ].epoll, EPOLL_CTL_ADD, server->socket, &event ) != 0 ||
+			 pthread_create( &thread[ index ].thread, NULL, reactor_run, &thread[ index ] ) != 0 )
+		{
+			close( thread[ index ].epoll );
+			break;
+		}
+		started ++;
+	}
+
+	if ( started == 0 )
+	{
+		melted_log( LOG_ERR, "%s unable to start I/O threads.", server->id );
+		return -1;
+	}
+
+	melted_log( LOG_NOTICE, "%s using %d I/O threads.", server->id, started );
+
+	for ( index = 0; index < started; index ++ )
+	{
+		pthread_join( thread[ index ].thread, NULL );
+		close( thread[ index ].epoll );
+	}
+
+	return 0;
+}
+
+#else
+
+int melted_reactor_available( )
+{
+	return 0;
+}
+
+int melted_reactor_run( melted_server server, int threads )
+{
+	return -1;
+}
+
+#endif
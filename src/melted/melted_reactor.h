@@ -0,0 +1,43 @@
+/*
+ * melted_reactor.h -- Event Driven Connection Handler
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MELTED_REACTOR_H_
+#define _MELTED_REACTOR_H_
+
+/* Application header files */
+#include "melted_server.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Maximum number of I/O threads the reactor will start.
+*/
+
+#define MELTED_REACTOR_MAX_THREADS 64
+
+extern int melted_reactor_available( );
+extern int melted_reactor_run( melted_server, int );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
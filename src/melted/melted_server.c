@@ -25,6 +25,7 @@
 #include <signal.h>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -39,6 +40,7 @@
 /* Application header files */
 #include "melted_server.h"
 #include "melted_connection.h"
+#include "melted_reactor.h"
 #include "melted_local.h"
 #include "melted_log.h"
 #include "melted_commands.h"
@@ -119,22 +121,35 @@ void melted_server_set_proxy( melted_server server, char *proxy )
 	mvcp_tokeniser_close( tokeniser );
 }
 
+/** Set the number of I/O threads used to service connections.
+
+	Zero (the default) gives each connection a thread of its own. A positive
+	number multiplexes all connections over that many threads where the
+	platform supports it.
+*/
+
+void melted_server_set_io_threads( melted_server server, int threads )
+{
+	if ( threads > 0 && !melted_reactor_available( ) )
+	{
+		melted_log( LOG_WARNING, "%s event driven I/O is not available on this platform.", server->id );
+		threads = 0;
+	}
+	server->io_threads = threads;
+}
+
 /** Wait for a connection.
 */
 
 static int melted_server_wait_for_connect( melted_server server )
 {
-    struct timeval tv;
-    fd_set rfds;
+	struct pollfd pfd;
 
-    /* Wait for a 1 second. */
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
+	pfd.fd = server->socket;
+	pfd.events = POLLIN;
 
-    FD_ZERO( &rfds );
-    FD_SET( server->socket, &rfds );
-
-    return select( server->socket + 1, &rfds, NULL, NULL, &tv);
+	/* Wait for a 1 second. */
+	return poll( &pfd, 1, 1000 );
 }
 
 /** Run the server thread.
@@ -157,7 +172,11 @@ static void *melted_server_run( void *arg )
 	pthread_attr_init( &thread_attributes );
 	pthread_attr_setdetachstate( &thread_attributes, PTHREAD_CREATE_DETACHED );
 
-	while ( !server->shutdown )
+	/* The reactor only returns early if it couldn't start, in which case fall back to a thread per connection */
+	if ( server->io_threads > 0 && melted_reactor_run( server, server->io_threads ) != 0 )
+		server->io_threads = 0;
+
+	while ( !server->shutdown && server->io_threads == 0 )
 	{
 		/* Wait for a new connection. */
 		if ( melted_server_wait_for_connect( server ) )
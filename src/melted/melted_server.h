@@ -53,6 +53,7 @@ typedef struct
 	char remote_server[ 50 ];
 	int remote_port;
 	char *config;
+	int io_threads;
 }
 *melted_server, melted_server_t;
 
@@ -64,6 +65,7 @@ extern const char *melted_server_id( melted_server );
 extern void melted_server_set_config( melted_server, const char * );
 extern void melted_server_set_port( melted_server, int );
 extern void melted_server_set_proxy( melted_server, char * );
+extern void melted_server_set_io_threads( melted_server, int );
 extern int melted_server_execute( melted_server );
 extern mlt_properties melted_server_fetch_unit( melted_server, int );
 extern void melted_server_shutdown( melted_server );
@@ -40,12 +40,30 @@
 #include "melted_unit.h"
 #include "melted_log.h"
 #include "melted_local.h"
+#include "melted_cache.h"
+#include "melted_loader.h"
 
 #include <framework/mlt.h>
 
 /* Forward references */
 static void melted_unit_status_communicate( melted_unit );
 
+/** Number of playlist generations remembered by the change journal.
+*/
+
+#define JOURNAL_SIZE 256
+
+/** The change journal - for each of the most recent generations, the index
+	of the first playlist entry which may have changed in it. Entries from
+	there to the end of the playlist may differ from the previous generation.
+*/
+
+typedef struct
+{
+	int first[ JOURNAL_SIZE ];
+}
+*journal, journal_t;
+
 /** Allocate a new playout unit.
 
     \return A new melted_unit handle.
@@ -74,6 +92,7 @@ melted_unit melted_unit_init( int index, char *constructor )
 		mlt_properties_init( this->properties, this );
 		mlt_properties_set_int( this->properties, "unit", index );
 		mlt_properties_set_int( this->properties, "generation", 0 );
+		mlt_properties_set_data( this->properties, "_journal", calloc( 1, sizeof( journal_t ) ), 0, free, NULL );
 		mlt_properties_set( this->properties, "constructor", constructor );
 		mlt_properties_set( this->properties, "id", id );
 		mlt_properties_set( this->properties, "arg", arg );
@@ -111,19 +130,51 @@ static void melted_unit_status_communicate( melted_unit unit )
 		mlt_properties properties = unit->properties;
 		char *root_dir = mlt_properties_get( properties, "root" );
 		mvcp_notifier notifier = mlt_properties_get_data( properties, "notifier", NULL );
-		mvcp_status_t status;
+		mvcp_status_record_t status;
+
+		memset( &status, 0, sizeof( status ) );
 
 		if ( root_dir != NULL && notifier != NULL )
 		{
-			if ( melted_unit_get_status( unit, &status ) == 0 )
+			if ( melted_unit_get_status_record( unit, &status ) == 0 )
 				/* if ( !( ( status.status == unit_playing || status.status == unit_paused ) &&
 						strcmp( status.clip, "" ) && 
 				    	!strcmp( status.tail_clip, "" ) && 
 						status.position == 0 && 
 						status.in == 0 && 
 						status.out == 0 ) ) */
-					mvcp_notifier_put( notifier, &status );
+					mvcp_notifier_put_record( notifier, &status );
+		}
+
+		mvcp_status_record_clear( &status );
+	}
+}
+
+/** Publish the status as frames are shown, according to the status_rate
+	property of the unit - 0 (the default) leaves it to the commands, "clip"
+	publishes when the clip changes and N every N frames as well.
+*/
+
+static void melted_unit_frame_shown( mlt_consumer consumer, melted_unit unit, mlt_frame frame )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mlt_properties playlist_properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	char *rate = mlt_properties_get( playlist_properties, "status_rate" );
+
+	if ( rate != NULL && strcmp( rate, "" ) && strcmp( rate, "0" ) )
+	{
+		int frames = mlt_properties_get_int( properties, "_status_frames" ) + 1;
+		int clip = mlt_playlist_current_clip( playlist );
+		int every = strcmp( rate, "clip" ) ? atoi( rate ) : 0;
+
+		if ( clip != mlt_properties_get_int( properties, "_status_clip" ) || ( every > 0 && frames >= every ) )
+		{
+			mlt_properties_set_int( properties, "_status_clip", clip );
+			frames = 0;
+			melted_unit_status_communicate( unit );
 		}
+		mlt_properties_set_int( properties, "_status_frames", frames );
 	}
 }
 
@@ -141,6 +192,14 @@ void melted_unit_set_notifier( melted_unit this, mvcp_notifier notifier, char *r
 	mlt_properties_set_data( playlist_properties, "notifier_arg", this, 0, NULL, NULL );
 	mlt_properties_set_data( playlist_properties, "notifier", melted_unit_status_communicate, 0, NULL, NULL );
 
+	if ( !mlt_properties_get_int( properties, "_status_listener" ) )
+	{
+		mlt_consumer consumer = mlt_properties_get_data( properties, "consumer", NULL );
+		mlt_properties_set_int( properties, "_status_clip", -1 );
+		mlt_events_listen( MLT_CONSUMER_PROPERTIES( consumer ), this, "consumer-frame-show", ( mlt_listener )melted_unit_frame_shown );
+		mlt_properties_set_int( properties, "_status_listener", 1 );
+	}
+
 	melted_unit_status_communicate( this );
 }
 
@@ -160,6 +219,14 @@ static mlt_producer locate_producer( melted_unit unit, char *file )
 		profile = mlt_service_profile( MLT_CONSUMER_SERVICE( consumer ) );
 	}
 
+	// Producers with unit specific properties can't be shared
+	if ( m_prop == NULL || mlt_properties_count( m_prop ) == 0 )
+	{
+		producer = melted_cache_get( mlt_properties_get_int( unit->properties, "unit" ), profile, file );
+		if ( producer != NULL )
+			return producer;
+	}
+
 	producer = mlt_factory_producer( profile, NULL, file );
 	if( producer )
 	{
@@ -170,14 +237,29 @@ static mlt_producer locate_producer( melted_unit unit, char *file )
 	return producer;
 }
 
-/** Update the generation count.
+/** Update the generation count and journal the first clip changed. Must be
+	called with the playlist locked, in the same section as the change, so a
+	LIST never sees a change without its generation.
 */
 
-static void update_generation( melted_unit unit )
+static void update_generation( melted_unit unit, int first )
 {
 	mlt_properties properties = unit->properties;
-	int generation = mlt_properties_get_int( properties, "generation" );
-	mlt_properties_set_int( properties, "generation", ++ generation );
+	journal changes = mlt_properties_get_data( properties, "_journal", NULL );
+	int generation = mlt_properties_get_int( properties, "generation" ) + 1;
+
+	if ( changes != NULL )
+		changes->first[ generation % JOURNAL_SIZE ] = first < 0 ? 0 : first;
+	mlt_properties_set_int( properties, "generation", generation );
+}
+
+/** Limit a clip index to the positions at which a clip can be inserted.
+*/
+
+static int clamp_index( mlt_playlist playlist, int index )
+{
+	int count = mlt_playlist_count( playlist );
+	return index < 0 ? 0 : index > count ? count : index;
 }
 
 /** Wipe all clips on the playlist for this unit.
@@ -194,9 +276,8 @@ static void clear_unit( melted_unit unit )
 	mlt_playlist_clear( playlist );
 	mlt_producer_seek( producer, 0 );
 	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
+	update_generation( unit, 0 );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-
-	update_generation( unit );
 }
 
 /** Wipe all but the playing clip from the unit.
@@ -214,21 +295,22 @@ static void clean_unit( melted_unit unit )
 	double speed = mlt_producer_get_speed( producer );
 	mlt_playlist_get_clip_info( playlist, &info, current );
 
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 	if ( info.producer != NULL )
 	{
 		mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( info.producer ) );
 		position -= info.start;
-		clear_unit( unit );
-		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+		mlt_playlist_clear( playlist );
 		mlt_playlist_append_io( playlist, info.producer, info.frame_in, info.frame_out );
 		mlt_producer_seek( producer, position );
 		mlt_producer_set_speed( producer, speed );
 		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES(consumer), "refresh", 1 );
-		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-		mlt_producer_close( info.producer );
 	}
-	
-	update_generation( unit );
+	update_generation( unit, 0 );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( info.producer != NULL )
+		mlt_producer_close( info.producer );
 }
 
 /** Remove everything up to the current clip from the unit.
@@ -242,14 +324,145 @@ static void wipe_unit( melted_unit unit )
 	int current = mlt_playlist_current_clip( playlist );
 	mlt_playlist_get_clip_info( playlist, &info, current );
 
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 	if ( info.producer != NULL && info.start > 0 )
-	{
-		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 		mlt_playlist_remove_region( playlist, 0, info.start );
-		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	update_generation( unit, 0 );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+}
+
+/** The formatted rows of LIST for one generation of the playlist - every
+	LIST of the unit shares them until the playlist changes.
+*/
+
+typedef struct
+{
+	int generation;
+	char *root;
+	char *text;
+	int size;
+	int *offsets;
+	int count;
+}
+*listing, listing_t;
+
+static void listing_close( listing rows )
+{
+	if ( rows != NULL )
+	{
+		free( rows->root );
+		free( rows->text );
+		free( rows->offsets );
+		free( rows );
 	}
-	
-	update_generation( unit );
+}
+
+/** Format a playlist entry as a row of LIST.
+*/
+
+static int format_entry( melted_unit unit, mlt_playlist playlist, int i, char *row, int size )
+{
+	mlt_playlist_clip_info info;
+	char *title;
+	int length;
+	mlt_playlist_get_clip_info( playlist , &info, i );
+	title = mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "title" );
+	if ( title == NULL )
+		title = strip_root( unit, info.resource );
+	length = snprintf( row, size, "%d \"%s\" %d %d %d %d %.2f\n", 
+							 i, 
+							 title,
+							 info.frame_in, 
+							 info.frame_out,
+							 info.frame_count, 
+							 info.length, 
+							 info.fps );
+	return length < size ? length : size - 1;
+}
+
+/** Get the formatted rows for the current generation, formatting them when
+	the playlist has changed since they were last formatted. Must be called
+	with the playlist locked.
+*/
+
+static listing get_listing( melted_unit unit, mlt_playlist playlist )
+{
+	mlt_properties properties = unit->properties;
+	listing rows = mlt_properties_get_data( properties, "_listing", NULL );
+	int generation = mlt_properties_get_int( properties, "generation" );
+	char *root = mlt_properties_get( properties, "root" );
+	int count = mlt_playlist_count( playlist );
+	char row[ 10240 ];
+	int used = 0;
+	int i;
+
+	if ( rows != NULL && rows->generation == generation && rows->count == count &&
+		 ( rows->root == root || ( rows->root != NULL && root != NULL && !strcmp( rows->root, root ) ) ) )
+		return rows;
+
+	if ( rows == NULL )
+	{
+		rows = calloc( 1, sizeof( listing_t ) );
+		if ( rows == NULL )
+			return NULL;
+		mlt_properties_set_data( properties, "_listing", rows, 0, ( mlt_destructor )listing_close, NULL );
+	}
+
+	free( rows->root );
+	free( rows->offsets );
+	rows->root = root != NULL ? strdup( root ) : NULL;
+	rows->offsets = malloc( ( count + 1 ) * sizeof( int ) );
+	rows->count = -1;
+	if ( rows->offsets == NULL )
+		return NULL;
+
+	for ( i = 0; i < count; i ++ )
+	{
+		int length = format_entry( unit, playlist, i, row, sizeof( row ) );
+		if ( used + length >= rows->size )
+		{
+			int size = rows->size ? rows->size * 2 : 4096;
+			char *text = NULL;
+			while ( used + length >= size )
+				size *= 2;
+			text = realloc( rows->text, size );
+			if ( text == NULL )
+				return NULL;
+			rows->text = text;
+			rows->size = size;
+		}
+		rows->offsets[ i ] = used;
+		memcpy( rows->text + used, row, length );
+		used += length;
+	}
+
+	rows->offsets[ count ] = used;
+	rows->generation = generation;
+	rows->count = count;
+
+	return rows;
+}
+
+/** Report the playlist entries from first onwards.
+*/
+
+static void report_entries( melted_unit unit, mlt_playlist playlist, mvcp_response response, int first )
+{
+	listing rows = get_listing( unit, playlist );
+
+	if ( rows != NULL )
+	{
+		if ( first < rows->count )
+			mvcp_response_write( response, rows->text + rows->offsets[ first ], rows->offsets[ rows->count ] - rows->offsets[ first ] );
+	}
+	else
+	{
+		char row[ 10240 ];
+		int i;
+		for ( i = first; i < mlt_playlist_count( playlist ); i ++ )
+			mvcp_response_write( response, row, format_entry( unit, playlist, i, row, sizeof( row ) ) );
+	}
+	mvcp_response_printf( response, 1024, "\n" );
 }
 
 /** Generate a report on all loaded clips.
@@ -257,31 +470,75 @@ static void wipe_unit( melted_unit unit )
 
 void melted_unit_report_list( melted_unit unit, mvcp_response response )
 {
-	int i;
 	mlt_properties properties = unit->properties;
-	int generation = mlt_properties_get_int( properties, "generation" );
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 
-	mvcp_response_printf( response, 1024, "%d\n", generation );
-		
-	for ( i = 0; i < mlt_playlist_count( playlist ); i ++ )
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mvcp_response_printf( response, 1024, "%d\n", mlt_properties_get_int( properties, "generation" ) );
+	report_entries( unit, playlist, response, 0 );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+}
+
+/** Generate a report on the clips which have changed since the generation
+	given. The first line holds the current generation, the number of clips
+	and the index of the first clip reported - clips before that one are
+	unchanged and clips from there on follow. When the generation is too old
+	to be found in the journal, every clip is reported.
+*/
+
+void melted_unit_report_changes( melted_unit unit, mvcp_response response, int since )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	journal changes = mlt_properties_get_data( properties, "_journal", NULL );
+	int generation = 0;
+	int count = 0;
+	int first = 0;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	generation = mlt_properties_get_int( properties, "generation" );
+	count = mlt_playlist_count( playlist );
+
+	if ( changes != NULL && since <= generation && generation - since < JOURNAL_SIZE )
 	{
-		mlt_playlist_clip_info info;
-		char *title;
-		mlt_playlist_get_clip_info( playlist , &info, i );
-		title = mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "title" );
-		if ( title == NULL )
-			title = strip_root( unit, info.resource );
-		mvcp_response_printf( response, 10240, "%d \"%s\" %d %d %d %d %.2f\n", 
-								 i, 
-								 title,
-								 info.frame_in, 
-								 info.frame_out,
-								 info.frame_count, 
-								 info.length, 
-								 info.fps );
+		int i;
+		first = count;
+		for ( i = since + 1; i <= generation; i ++ )
+			if ( changes->first[ i % JOURNAL_SIZE ] < first )
+				first = changes->first[ i % JOURNAL_SIZE ];
 	}
-	mvcp_response_printf( response, 1024, "\n" );
+
+	mvcp_response_printf( response, 1024, "%d %d %d\n", generation, count, first );
+	report_entries( unit, playlist, response, first );
+
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+}
+
+/** Create a producer for a clip with the unit's profile and producer
+	properties - this may take a while and is safe to call from any thread.
+*/
+
+mlt_producer melted_unit_locate( melted_unit unit, char *clip )
+{
+	return locate_producer( unit, clip );
+}
+
+/** Replace the playlist with a producer.
+*/
+
+mvcp_error_code melted_unit_load_producer( melted_unit unit, mlt_producer instance, int32_t in, int32_t out, int flush )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	int original = mlt_producer_get_playtime( MLT_PLAYLIST_PRODUCER( playlist ) );
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	mlt_playlist_append_io( playlist, instance, in, out );
+	mlt_playlist_remove_region( playlist, 0, original );
+	update_generation( unit, 0 );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	melted_unit_status_communicate( unit );
+	return mvcp_ok;
 }
 
 /** Load a clip into the unit clearing existing play list.
@@ -300,16 +557,8 @@ mvcp_error_code melted_unit_load( melted_unit unit, char *clip, int32_t in, int3
 
 	if ( instance != NULL )
 	{
-		mlt_properties properties = unit->properties;
-		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-		int original = mlt_producer_get_playtime( MLT_PLAYLIST_PRODUCER( playlist ) );
-		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
-		mlt_playlist_append_io( playlist, instance, in, out );
-		mlt_playlist_remove_region( playlist, 0, original );
-		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		melted_unit_load_producer( unit, instance, in, out, flush );
 		melted_log( LOG_DEBUG, "loaded clip %s", clip );
-		update_generation( unit );
-		melted_unit_status_communicate( unit );
 		mlt_producer_close( instance );
 		return mvcp_ok;
 	}
@@ -317,21 +566,32 @@ mvcp_error_code melted_unit_load( melted_unit unit, char *clip, int32_t in, int3
 	return mvcp_invalid_file;
 }
 
+/** Insert a producer into the playlist.
+*/
+
+mvcp_error_code melted_unit_insert_producer( melted_unit unit, mlt_producer instance, int index, int32_t in, int32_t out )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	int first = 0;
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	first = clamp_index( playlist, index );
+	mlt_playlist_insert( playlist, instance, index, in, out );
+	update_generation( unit, first );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+	melted_unit_status_communicate( unit );
+	return mvcp_ok;
+}
+
 mvcp_error_code melted_unit_insert( melted_unit unit, char *clip, int index, int32_t in, int32_t out )
 {
 	mlt_producer instance = locate_producer( unit, clip );
 
 	if ( instance != NULL )
 	{
-		mlt_properties properties = unit->properties;
-		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 		fprintf( stderr, "inserting clip %s before %d\n", clip, index );
-		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
-		mlt_playlist_insert( playlist, instance, index, in, out );
-		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+		melted_unit_insert_producer( unit, instance, index, in, out );
 		melted_log( LOG_DEBUG, "inserted clip %s at %d", clip, index );
-		update_generation( unit );
-		melted_unit_status_communicate( unit );
 		mlt_producer_close( instance );
 		return mvcp_ok;
 	}
@@ -345,9 +605,9 @@ mvcp_error_code melted_unit_remove( melted_unit unit, int index )
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 	mlt_playlist_remove( playlist, index );
+	update_generation( unit, index );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 	melted_log( LOG_DEBUG, "removed clip at %d", index );
-	update_generation( unit );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
 }
@@ -382,11 +642,116 @@ mvcp_error_code melted_unit_move( melted_unit unit, int src, int dest )
 {
 	mlt_properties properties = unit->properties;
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	int first = src < dest ? src : dest;
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 	mlt_playlist_move( playlist, src, dest );
+	update_generation( unit, first );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 	melted_log( LOG_DEBUG, "moved clip %d to %d", src, dest );
-	update_generation( unit );
+	melted_unit_status_communicate( unit );
+	return mvcp_ok;
+}
+
+/** Apply a batch of playlist operations.
+
+	The operations are checked against the playlist before any of them are
+	applied, so either all of them are applied or none are, and they are
+	applied under a single lock with a single generation change and status
+	notification. Producers in the batch are not closed. On failure, the
+	index of the offending operation is returned in failed.
+*/
+
+mvcp_error_code melted_unit_apply( melted_unit unit, melted_unit_batch batch, int count, int *failed )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	mvcp_error_code error = mvcp_ok;
+	int clips = 0;
+	int first = 0;
+	int i = 0;
+
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	clips = mlt_playlist_count( playlist );
+	first = clips;
+	for ( i = 0; i < count && error == mvcp_ok; i ++ )
+	{
+		int index = batch[ i ].index;
+		switch( batch[ i ].action )
+		{
+			case melted_unit_batch_append:
+				index = clips;
+				/* fall through */
+			case melted_unit_batch_insert:
+				if ( batch[ i ].producer == NULL )
+					error = mvcp_invalid_file;
+				index = index < 0 ? 0 : index > clips ? clips : index;
+				clips ++;
+				break;
+			case melted_unit_batch_remove:
+				if ( batch[ i ].index < 0 || batch[ i ].index >= clips )
+					error = mvcp_invalid_position;
+				clips --;
+				break;
+			case melted_unit_batch_move:
+				if ( batch[ i ].index < 0 || batch[ i ].index >= clips )
+					error = mvcp_invalid_position;
+				if ( batch[ i ].dest < index )
+					index = batch[ i ].dest < 0 ? 0 : batch[ i ].dest;
+				break;
+		}
+		if ( index < first )
+			first = index;
+		if ( error != mvcp_ok && failed != NULL )
+			*failed = i;
+	}
+
+	for ( i = 0; i < count && error == mvcp_ok; i ++ )
+	{
+		switch( batch[ i ].action )
+		{
+			case melted_unit_batch_append:
+				mlt_playlist_append_io( playlist, batch[ i ].producer, batch[ i ].in, batch[ i ].out );
+				break;
+			case melted_unit_batch_insert:
+				mlt_playlist_insert( playlist, batch[ i ].producer, batch[ i ].index, batch[ i ].in, batch[ i ].out );
+				break;
+			case melted_unit_batch_remove:
+				mlt_playlist_remove( playlist, batch[ i ].index );
+				break;
+			case melted_unit_batch_move:
+				mlt_playlist_move( playlist, batch[ i ].index, batch[ i ].dest );
+				break;
+		}
+	}
+
+	if ( error == mvcp_ok && count > 0 )
+		update_generation( unit, first );
+
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
+
+	if ( error == mvcp_ok && count > 0 )
+	{
+		melted_log( LOG_DEBUG, "applied %d playlist operations", count );
+		melted_unit_status_communicate( unit );
+	}
+
+	return error;
+}
+
+/** Append a producer to the playlist.
+*/
+
+mvcp_error_code melted_unit_append_producer( melted_unit unit, mlt_producer instance, int32_t in, int32_t out )
+{
+	mlt_properties properties = unit->properties;
+	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	int first = 0;
+	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	first = mlt_playlist_count( playlist );
+	mlt_playlist_append_io( playlist, instance, in, out );
+	update_generation( unit, first );
+	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
 }
@@ -406,14 +771,8 @@ mvcp_error_code melted_unit_append( melted_unit unit, char *clip, int32_t in, in
 
 	if ( instance != NULL )
 	{
-		mlt_properties properties = unit->properties;
-		mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
-		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
-		mlt_playlist_append_io( playlist, instance, in, out );
+		melted_unit_append_producer( unit, instance, in, out );
 		melted_log( LOG_DEBUG, "appended clip %s", clip );
-		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-		update_generation( unit );
-		melted_unit_status_communicate( unit );
 		mlt_producer_close( instance );
 		return mvcp_ok;
 	}
@@ -431,11 +790,13 @@ mvcp_error_code melted_unit_append_service( melted_unit unit, mlt_service servic
 {
 	mlt_properties properties = unit->properties;
 	mlt_playlist playlist = mlt_properties_get_data( properties, "playlist", NULL );
+	int first = 0;
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
+	first = mlt_playlist_count( playlist );
 	mlt_playlist_append( playlist, ( mlt_producer )service );
+	update_generation( unit, first );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
 	melted_log( LOG_DEBUG, "appended clip" );
-	update_generation( unit );
 	melted_unit_status_communicate( unit );
 	return mvcp_ok;
 }
@@ -500,6 +861,7 @@ int melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit )
 	mlt_properties src_properties = src_unit->properties;
 	mlt_playlist src_playlist = mlt_properties_get_data( src_properties, "playlist", NULL );
 	mlt_playlist tmp_playlist = mlt_playlist_init( );
+	int first = 0;
 
 	for ( i = 0; i < mlt_playlist_count( src_playlist ); i ++ )
 	{
@@ -513,6 +875,7 @@ int melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit )
 
 	mlt_service_lock( MLT_PLAYLIST_SERVICE( dest_playlist ) );
 
+	first = mlt_playlist_count( dest_playlist );
 	for ( i = 0; i < mlt_playlist_count( tmp_playlist ); i ++ )
 	{
 		mlt_playlist_clip_info info;
@@ -521,9 +884,9 @@ int melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit )
 			mlt_playlist_append_io( dest_playlist, info.producer, info.frame_in, info.frame_out );
 	}
 
+	update_generation( dest_unit, first );
 	mlt_service_unlock( MLT_PLAYLIST_SERVICE( dest_playlist ) );
 
-	update_generation( dest_unit );
 	melted_unit_status_communicate( dest_unit );
 
 	mlt_playlist_close( tmp_playlist );
@@ -539,14 +902,15 @@ int melted_unit_is_offline( melted_unit unit )
 	return 0;
 }
 
-/** Obtain the status for a given unit
+/** Obtain the status for a given unit as a compact record - the record must
+	be zeroed or previously used.
 */
 
-int melted_unit_get_status( melted_unit unit, mvcp_status status )
+int melted_unit_get_status_record( melted_unit unit, mvcp_status_record record )
 {
 	int error = unit == NULL;
 
-	memset( status, 0, sizeof( mvcp_status_t ) );
+	mvcp_status_record_clear( record );
 
 	if ( !error )
 	{
@@ -564,42 +928,70 @@ int melted_unit_get_status( melted_unit unit, mvcp_status status )
 			char *title = mlt_properties_get( MLT_PRODUCER_PROPERTIES( info.producer ), "title" );
 			if ( title == NULL )
 				title = strip_root( unit, info.resource );
-			strncpy( status->clip, title, sizeof( status->clip ) );
-			status->speed = (int)( mlt_producer_get_speed( producer ) * 1000.0 );
-			status->fps = info.fps;
-			status->in = info.frame_in;
-			status->out = info.frame_out;
-			status->position = mlt_producer_frame( clip );
-			status->length = mlt_producer_get_length( clip );
-			strncpy( status->tail_clip, title, sizeof( status->tail_clip ) );
-			status->tail_in = info.frame_in;
-			status->tail_out = info.frame_out;
-			status->tail_position = mlt_producer_frame( clip );
-			status->tail_length = mlt_producer_get_length( clip );
-			status->clip_index = mlt_playlist_current_clip( playlist );
-			status->seek_flag = 1;
+			record->clip = mvcp_title_intern( title, MVCP_STATUS_CLIP - 1 );
+			record->speed = (int)( mlt_producer_get_speed( producer ) * 1000.0 );
+			record->fps = info.fps;
+			record->in = info.frame_in;
+			record->out = info.frame_out;
+			record->position = mlt_producer_frame( clip );
+			record->length = mlt_producer_get_length( clip );
+			record->tail_clip = mvcp_title_ref( record->clip );
+			record->tail_in = info.frame_in;
+			record->tail_out = info.frame_out;
+			record->tail_position = mlt_producer_frame( clip );
+			record->tail_length = mlt_producer_get_length( clip );
+			record->clip_index = mlt_playlist_current_clip( playlist );
+			record->seek_flag = 1;
 		}
 
-		status->generation = mlt_properties_get_int( properties, "generation" );
+		record->generation = mlt_properties_get_int( properties, "generation" );
+		record->job = mlt_properties_get_int( properties, "_job" );
+		record->job_state = ( job_status )mlt_properties_get_int( properties, "_job_state" );
 
 		if ( melted_unit_has_terminated( unit ) )
-			status->status = unit_stopped;
-		else if ( !strcmp( status->clip, "" ) )
-			status->status = unit_not_loaded;
-		else if ( status->speed == 0 )
-			status->status = unit_paused;
+			record->status = unit_stopped;
+		else if ( record->clip == NULL )
+			record->status = unit_not_loaded;
+		else if ( record->speed == 0 )
+			record->status = unit_paused;
 		else
-			status->status = unit_playing;
-		status->unit = mlt_properties_get_int( unit->properties, "unit" );
+			record->status = unit_playing;
+		record->unit = mlt_properties_get_int( unit->properties, "unit" );
 	}
 	else
 	{
-		status->status = unit_undefined;
+		record->status = unit_undefined;
 	}
 
 	return error;
 }
 
+/** Obtain the status for a given unit
+*/
+
+int melted_unit_get_status( melted_unit unit, mvcp_status status )
+{
+	mvcp_status_record_t record;
+	int error = 0;
+
+	memset( &record, 0, sizeof( record ) );
+	error = melted_unit_get_status_record( unit, &record );
+	mvcp_status_unpack( status, &record );
+	mvcp_status_record_clear( &record );
+
+	return error;
+}
+
+/** Publish the outcome of an asynchronous job on the status stream.
+*/
+
+void melted_unit_report_job( melted_unit unit, int job, job_status state )
+{
+	mlt_properties_set_int( unit->properties, "_job", job );
+	mlt_properties_set_int( unit->properties, "_job_state", state );
+	melted_unit_status_communicate( unit );
+}
+
 /** Change position in the playlist.
 */
 
@@ -667,8 +1059,8 @@ int melted_unit_set_clip_in( melted_unit unit, int index, int32_t position )
 		melted_unit_play( unit, 0 );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 		error = mlt_playlist_resize_clip( playlist, index, position, info.frame_out );
+		update_generation( unit, index );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-		update_generation( unit );
 		melted_unit_change_position( unit, index, 0 );
 	}
 
@@ -690,8 +1082,8 @@ int melted_unit_set_clip_out( melted_unit unit, int index, int32_t position )
 		melted_unit_play( unit, 0 );
 		mlt_service_lock( MLT_PLAYLIST_SERVICE( playlist ) );
 		error = mlt_playlist_resize_clip( playlist, index, info.frame_in, position );
+		update_generation( unit, index );
 		mlt_service_unlock( MLT_PLAYLIST_SERVICE( playlist ) );
-		update_generation( unit );
 		melted_unit_status_communicate( unit );
 		melted_unit_change_position( unit, index, -1 );
 	}
@@ -783,6 +1175,8 @@ char *melted_unit_get( melted_unit unit, char *name )
 {
 	mlt_playlist playlist = mlt_properties_get_data( unit->properties, "playlist", NULL );
 	mlt_properties properties = MLT_PLAYLIST_PROPERTIES( playlist );
+	if ( !strncmp( name, "job.", 4 ) )
+		return ( char * )melted_loader_state( unit, atoi( name + 4 ) );
 	return mlt_properties_get( properties, name );
 }
 
@@ -798,6 +1192,11 @@ void melted_unit_close( melted_unit unit )
 	{
 		melted_log( LOG_DEBUG, "closing unit..." );
 		melted_unit_terminate( unit );
+		if ( mlt_properties_get_int( unit->properties, "_status_listener" ) )
+		{
+			mlt_consumer consumer = mlt_properties_get_data( unit->properties, "consumer", NULL );
+			mlt_events_disconnect( MLT_CONSUMER_PROPERTIES( consumer ), unit );
+		}
 		mlt_properties_close( unit->properties );
 		free( unit );
 		melted_log( LOG_DEBUG, "... unit closed." );
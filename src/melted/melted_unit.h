@@ -37,18 +37,47 @@ typedef struct
 } 
 melted_unit_t, *melted_unit;
 
+/** Playlist operations which can be applied as a batch.
+*/
+
+typedef enum
+{
+	melted_unit_batch_append,
+	melted_unit_batch_insert,
+	melted_unit_batch_remove,
+	melted_unit_batch_move
+}
+melted_unit_batch_action;
+
+typedef struct
+{
+	melted_unit_batch_action action;
+	mlt_producer producer;
+	int index;
+	int dest;
+	int32_t in;
+	int32_t out;
+}
+melted_unit_batch_t, *melted_unit_batch;
+
 extern melted_unit         melted_unit_init( int index, char *arg );
 extern void 				melted_unit_report_list( melted_unit unit, mvcp_response response );
+extern void 				melted_unit_report_changes( melted_unit unit, mvcp_response response, int since );
 extern void                 melted_unit_allow_stdin( melted_unit unit, int flag );
 extern mvcp_error_code   melted_unit_load( melted_unit unit, char *clip, int32_t in, int32_t out, int flush );
 extern mvcp_error_code 	melted_unit_insert( melted_unit unit, char *clip, int index, int32_t in, int32_t out );
 extern mvcp_error_code   melted_unit_append( melted_unit unit, char *clip, int32_t in, int32_t out );
 extern mvcp_error_code   melted_unit_append_service( melted_unit unit, mlt_service service );
+extern mlt_producer         melted_unit_locate( melted_unit unit, char *clip );
+extern mvcp_error_code   melted_unit_load_producer( melted_unit unit, mlt_producer producer, int32_t in, int32_t out, int flush );
+extern mvcp_error_code   melted_unit_insert_producer( melted_unit unit, mlt_producer producer, int index, int32_t in, int32_t out );
+extern mvcp_error_code   melted_unit_append_producer( melted_unit unit, mlt_producer producer, int32_t in, int32_t out );
 extern mvcp_error_code 	melted_unit_remove( melted_unit unit, int index );
 extern mvcp_error_code 	melted_unit_clean( melted_unit unit );
 extern mvcp_error_code 	melted_unit_wipe( melted_unit unit );
 extern mvcp_error_code 	melted_unit_clear( melted_unit unit );
 extern mvcp_error_code 	melted_unit_move( melted_unit unit, int src, int dest );
+extern mvcp_error_code 	melted_unit_apply( melted_unit unit, melted_unit_batch batch, int count, int *failed );
 extern int                  melted_unit_transfer( melted_unit dest_unit, melted_unit src_unit );
 extern void                 melted_unit_play( melted_unit_t *unit, int speed );
 extern void                 melted_unit_terminate( melted_unit );
@@ -58,6 +87,8 @@ extern int                  melted_unit_get_channel( melted_unit unit );
 extern int                  melted_unit_is_offline( melted_unit unit );
 extern void                 melted_unit_set_notifier( melted_unit, mvcp_notifier, char * );
 extern int                  melted_unit_get_status( melted_unit, mvcp_status );
+extern int                  melted_unit_get_status_record( melted_unit, mvcp_status_record );
+extern void                 melted_unit_report_job( melted_unit, int, job_status );
 extern void                 melted_unit_change_position( melted_unit, int, int32_t position );
 extern void                 melted_unit_change_speed( melted_unit unit, int speed );
 extern int                  melted_unit_set_clip_in( melted_unit unit, int index, int32_t position );
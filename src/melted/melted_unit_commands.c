@@ -30,11 +30,35 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <mvcp/mvcp_util.h>
+
 #include "melted_unit.h"
 #include "melted_commands.h"
+#include "melted_loader.h"
 #include "melted_log.h"
 
 
+/** Queue a clip to be loaded by the loader threads when the unit has the
+	async property set. Returns 0 when the unit loads synchronously and
+	otherwise the response, with the job id in its body.
+*/
+
+static int melted_submit( command_argument cmd_arg, melted_unit unit, melted_loader_action action, char *clip, int index, int32_t in, int32_t out, int flush )
+{
+	char *async = melted_unit_get( unit, "async" );
+	int id = 0;
+
+	if ( async == NULL || !atoi( async ) )
+		return 0;
+
+	id = melted_loader_submit( unit, action, clip, index, in, out, flush );
+	if ( id < 0 )
+		return RESPONSE_ERROR;
+
+	mvcp_response_printf( cmd_arg->response, 32, "%d\n", id );
+	return RESPONSE_SUCCESS_1;
+}
+
 void get_fullname( command_argument cmd_arg, char *fullname, size_t len, char *filename )
 {
 	char *service = strchr( filename, ':' );
@@ -78,11 +102,15 @@ int melted_load( command_argument cmd_arg )
 	else
 	{
 		int32_t in = -1, out = -1;
+		int async = 0;
 		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) == 5 )
 		{
 			in = atol( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 3 ) );
 			out = atol( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 4 ) );
 		}
+		async = melted_submit( cmd_arg, unit, melted_loader_load, fullname, 0, in, out, flush );
+		if ( async )
+			return async;
 		if ( melted_unit_load( unit, fullname, in, out, flush ) != mvcp_ok )
 			return RESPONSE_BAD_FILE;
 	}
@@ -95,28 +123,34 @@ int melted_list( command_argument cmd_arg )
 
 	if ( unit != NULL )
 	{
-		melted_unit_report_list( unit, cmd_arg->response );
+		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > 2 )
+			melted_unit_report_changes( unit, cmd_arg->response, atoi( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 2 ) ) );
+		else
+			melted_unit_report_list( unit, cmd_arg->response );
 		return RESPONSE_SUCCESS;
 	}
 
 	return RESPONSE_INVALID_UNIT;
 }
 
+static int parse_clip_token( int clip, char *token )
+{
+	if ( token[ 0 ] == '+' )
+		clip += atoi( token + 1 );
+	else if ( token[ 0 ] == '-' )
+		clip -= atoi( token + 1 );
+	else
+		clip = atoi( token );
+	return clip;
+}
+
 static int parse_clip( command_argument cmd_arg, int arg )
 {
 	melted_unit unit = melted_get_unit(cmd_arg->unit);
 	int clip = melted_unit_get_current_clip( unit );
 	
 	if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) > arg )
-	{
-		char *token = mvcp_tokeniser_get_string( cmd_arg->tokeniser, arg );
-		if ( token[ 0 ] == '+' )
-			clip += atoi( token + 1 );
-		else if ( token[ 0 ] == '-' )
-			clip -= atoi( token + 1 );
-		else
-			clip = atoi( token );
-	}
+		clip = parse_clip_token( clip, mvcp_tokeniser_get_string( cmd_arg->tokeniser, arg ) );
 	
 	return clip;
 }
@@ -135,6 +169,7 @@ int melted_insert( command_argument cmd_arg )
 	{
 		long in = -1, out = -1;
 		int index = parse_clip( cmd_arg, 3 );
+		int async = 0;
 		
 		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) == 6 )
 		{
@@ -142,6 +177,10 @@ int melted_insert( command_argument cmd_arg )
 			out = atoi( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 5 ) );
 		}
 		
+		async = melted_submit( cmd_arg, unit, melted_loader_insert, fullname, index, in, out, 0 );
+		if ( async )
+			return async;
+
 		switch( melted_unit_insert( unit, fullname, index, in, out ) )
 		{
 			case mvcp_ok:
@@ -251,11 +290,16 @@ int melted_append( command_argument cmd_arg )
 	else
 	{
 		int32_t in = -1, out = -1;
+		int async = 0;
 		if ( mvcp_tokeniser_count( cmd_arg->tokeniser ) == 5 )
 		{
 			in = atol( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 3 ) );
 			out = atol( mvcp_tokeniser_get_string( cmd_arg->tokeniser, 4 ) );
 		}
+		async = melted_submit( cmd_arg, unit, melted_loader_append, fullname, 0, in, out, 0 );
+		if ( async )
+			return async;
+
 		switch ( melted_unit_append( unit, fullname, in, out ) )
 		{
 			case mvcp_ok:
@@ -440,18 +484,20 @@ int melted_set_out_point( command_argument cmd_arg )
 
 int melted_get_unit_status( command_argument cmd_arg )
 {
-	mvcp_status_t status;
-	int error = melted_unit_get_status( melted_get_unit( cmd_arg->unit ), &status );
+	mvcp_status_record_t status;
+	int error = 0;
 
-	if ( error )
-		return RESPONSE_INVALID_UNIT;
-	else
+	memset( &status, 0, sizeof( status ) );
+	error = melted_unit_get_status_record( melted_get_unit( cmd_arg->unit ), &status );
+
+	if ( !error )
 	{
 		char text[ 10240 ];
-		mvcp_response_printf( cmd_arg->response, sizeof( text ), mvcp_status_serialise( &status, text, sizeof( text ) ) );
-		return RESPONSE_SUCCESS_1;
+		mvcp_response_printf( cmd_arg->response, sizeof( text ), mvcp_status_record_serialise( &status, text, sizeof( text ) ) );
 	}
-	return 0;
+	mvcp_status_record_clear( &status );
+
+	return error ? RESPONSE_INVALID_UNIT : RESPONSE_SUCCESS_1;
 }
 
 
@@ -503,3 +549,165 @@ int melted_transfer( command_argument cmd_arg )
 	}
 	return RESPONSE_INVALID_UNIT;
 }
+
+/** Parse one line of a batch into an operation, opening the clip if there
+	is one. Relative clip indexes are taken from the current clip.
+*/
+
+static int melted_batch_parse( command_argument cmd_arg, melted_unit unit, mvcp_tokeniser tokeniser, int current, melted_unit_batch operation )
+{
+	int count = mvcp_tokeniser_count( tokeniser );
+	char *action = mvcp_tokeniser_get_string( tokeniser, 0 );
+	char fullname[1024];
+	int clip = 0;
+
+	memset( operation, 0, sizeof( melted_unit_batch_t ) );
+	operation->in = -1;
+	operation->out = -1;
+
+	if ( !strcasecmp( action, "APND" ) )
+	{
+		if ( count != 2 && count != 4 )
+			return RESPONSE_MISSING_ARG;
+		operation->action = melted_unit_batch_append;
+		if ( count == 4 )
+		{
+			operation->in = atol( mvcp_tokeniser_get_string( tokeniser, 2 ) );
+			operation->out = atol( mvcp_tokeniser_get_string( tokeniser, 3 ) );
+		}
+		clip = 1;
+	}
+	else if ( !strcasecmp( action, "INSERT" ) )
+	{
+		if ( count < 2 || count == 4 || count > 5 )
+			return RESPONSE_MISSING_ARG;
+		operation->action = melted_unit_batch_insert;
+		operation->index = count > 2 ? parse_clip_token( current, mvcp_tokeniser_get_string( tokeniser, 2 ) ) : current;
+		if ( count == 5 )
+		{
+			operation->in = atol( mvcp_tokeniser_get_string( tokeniser, 3 ) );
+			operation->out = atol( mvcp_tokeniser_get_string( tokeniser, 4 ) );
+		}
+		clip = 1;
+	}
+	else if ( !strcasecmp( action, "REMOVE" ) )
+	{
+		if ( count > 2 )
+			return RESPONSE_MISSING_ARG;
+		operation->action = melted_unit_batch_remove;
+		operation->index = count > 1 ? parse_clip_token( current, mvcp_tokeniser_get_string( tokeniser, 1 ) ) : current;
+	}
+	else if ( !strcasecmp( action, "MOVE" ) )
+	{
+		if ( count != 3 )
+			return RESPONSE_MISSING_ARG;
+		operation->action = melted_unit_batch_move;
+		operation->index = parse_clip_token( current, mvcp_tokeniser_get_string( tokeniser, 1 ) );
+		operation->dest = parse_clip_token( current, mvcp_tokeniser_get_string( tokeniser, 2 ) );
+	}
+	else
+	{
+		return RESPONSE_UNKNOWN_COMMAND;
+	}
+
+	if ( clip )
+	{
+		get_fullname( cmd_arg, fullname, sizeof(fullname), mvcp_tokeniser_get_string( tokeniser, 1 ) );
+		operation->producer = melted_unit_locate( unit, fullname );
+		if ( operation->producer == NULL )
+			return RESPONSE_BAD_FILE;
+	}
+
+	return RESPONSE_SUCCESS;
+}
+
+/** Apply a batch of playlist changes received as the body of a BATCH
+	command - one APND, INSERT, REMOVE or MOVE per line, without the unit.
+	Either every change is applied or none are.
+*/
+
+int melted_batch( command_argument cmd_arg, char *body )
+{
+	melted_unit unit = melted_get_unit(cmd_arg->unit);
+	mvcp_tokeniser lines = NULL;
+	mvcp_tokeniser tokeniser = NULL;
+	melted_unit_batch batch = NULL;
+	int size = 0;
+	int count = 0;
+	int current = 0;
+	int error = RESPONSE_SUCCESS;
+	int line = 0;
+	int i = 0;
+
+	if ( unit == NULL )
+		return RESPONSE_INVALID_UNIT;
+
+	lines = mvcp_tokeniser_init( );
+	tokeniser = mvcp_tokeniser_init( );
+	current = melted_unit_get_current_clip( unit );
+
+	if ( lines == NULL || tokeniser == NULL )
+		error = RESPONSE_ERROR;
+	else
+		mvcp_tokeniser_parse_new( lines, body, "\n" );
+
+	for ( line = 0; error == RESPONSE_SUCCESS && line < mvcp_tokeniser_count( lines ); line ++ )
+	{
+		char *text = mvcp_util_trim( mvcp_tokeniser_get_string( lines, line ) );
+
+		if ( !strcmp( text, "" ) )
+			continue;
+
+		if ( count == size )
+		{
+			int grown_size = size ? size * 2 : 64;
+			melted_unit_batch grown = realloc( batch, grown_size * sizeof( melted_unit_batch_t ) );
+			if ( grown != NULL )
+			{
+				batch = grown;
+				size = grown_size;
+			}
+			else
+			{
+				error = RESPONSE_ERROR;
+			}
+		}
+
+		if ( error == RESPONSE_SUCCESS )
+		{
+			mvcp_tokeniser_parse_new( tokeniser, text, " " );
+			for ( i = 0; i < mvcp_tokeniser_count( tokeniser ); i ++ )
+				mvcp_util_strip( mvcp_tokeniser_get_string( tokeniser, i ), '\"' );
+
+			error = melted_batch_parse( cmd_arg, unit, tokeniser, current, &batch[ count ] );
+			if ( error == RESPONSE_SUCCESS )
+				count ++;
+			else
+				mlt_producer_close( batch[ count ].producer );
+		}
+	}
+
+	if ( error == RESPONSE_SUCCESS )
+	{
+		int failed = 0;
+		mvcp_error_code result = melted_unit_apply( unit, batch, count, &failed );
+		if ( result == mvcp_invalid_position )
+			error = RESPONSE_OUT_OF_RANGE;
+		else if ( result != mvcp_ok )
+			error = RESPONSE_BAD_FILE;
+		if ( error != RESPONSE_SUCCESS )
+			melted_log( LOG_ERR, "BATCH operation %d failed", failed + 1 );
+	}
+	else
+	{
+		melted_log( LOG_ERR, "BATCH line %d failed", line );
+	}
+
+	for ( i = 0; i < count; i ++ )
+		mlt_producer_close( batch[ i ].producer );
+	free( batch );
+	mvcp_tokeniser_close( tokeniser );
+	mvcp_tokeniser_close( lines );
+
+	return error;
+}
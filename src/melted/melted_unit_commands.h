@@ -52,6 +52,7 @@ extern response_codes melted_set_unit_property( command_argument );
 extern response_codes melted_get_unit_property( command_argument );
 extern response_codes melted_transfer( command_argument );
 extern response_codes melted_push( command_argument, mlt_service );
+extern response_codes melted_batch( command_argument, char * );
 extern response_codes melted_receive( command_argument, char * );
 
 #ifdef __cplusplus
@@ -30,6 +30,28 @@
 static int consumer_is_stopped( mlt_consumer this );
 static int consumer_start( mlt_consumer this );
 
+/** Maximum number of idle connections kept for each server.
+*/
+
+#define POOL_MAX 4
+
+/** An idle connection kept for reuse by later consumers - connections are
+	shared across the process, keyed by server:port.
+*/
+
+typedef struct pool_link_s
+{
+	char *key;
+	mvcp_parser parser;
+	mvcp connection;
+	struct pool_link_s *next;
+}
+pool_link_t, *pool_link;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pool_link pool = NULL;
+static int pool_registered = 0;
+
 /** This is what will be called by the factory
 */
 
@@ -58,6 +80,7 @@ mlt_consumer consumer_mvcp_init( mlt_profile profile, mlt_service_type type, con
 
 		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( this ), "unit", 0 );
 		mlt_properties_set( MLT_CONSUMER_PROPERTIES( this ), "command", "append" );
+		mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( this ), "pool", 1 );
 
 		// Allow thread to be started/stopped
 		this->start = consumer_start;
@@ -74,6 +97,115 @@ mlt_consumer consumer_mvcp_init( mlt_profile profile, mlt_service_type type, con
 	return NULL;
 }
 
+/** Close a connection.
+*/
+
+static void pool_link_close( pool_link link )
+{
+	mvcp_close( link->connection );
+	mvcp_parser_close( link->parser );
+	free( link->key );
+	free( link );
+}
+
+/** Close all the idle connections - registered for clean up on first use.
+*/
+
+static void pool_close( void *unused )
+{
+	pool_link link = NULL;
+
+	pthread_mutex_lock( &pool_mutex );
+	link = pool;
+	pool = NULL;
+	pthread_mutex_unlock( &pool_mutex );
+
+	while ( link != NULL )
+	{
+		pool_link next = link->next;
+		pool_link_close( link );
+		link = next;
+	}
+}
+
+/** Take an idle connection to the server from the pool, or connect a new one
+	if there are none which are still usable. Returns NULL if the server
+	can't be reached.
+*/
+
+static pool_link pool_acquire( char *server, int port )
+{
+	pool_link link = NULL;
+	char key[ 512 ];
+
+	snprintf( key, sizeof( key ), "%s:%d", server, port );
+
+	while ( 1 )
+	{
+		pool_link *ptr = NULL;
+
+		pthread_mutex_lock( &pool_mutex );
+		for ( ptr = &pool; *ptr != NULL && strcmp( ( *ptr )->key, key ); ptr = &( *ptr )->next ) ;
+		link = *ptr;
+		if ( link != NULL )
+			*ptr = link->next;
+		pthread_mutex_unlock( &pool_mutex );
+
+		if ( link == NULL || mvcp_remote_check( link->parser ) == 0 )
+			break;
+
+		// The server closed it while it was idle
+		pool_link_close( link );
+	}
+
+	if ( link == NULL && ( link = calloc( 1, sizeof( pool_link_t ) ) ) != NULL )
+	{
+		link->key = strdup( key );
+		link->parser = mvcp_parser_init_remote( server, port );
+		mvcp_remote_set_silent( link->parser, 1 );
+		link->connection = mvcp_init( link->parser );
+		if ( mvcp_connect( link->connection ) != mvcp_ok )
+		{
+			pool_link_close( link );
+			link = NULL;
+		}
+	}
+
+	return link;
+}
+
+/** Return a connection to the pool - it's closed instead if it's broken or
+	enough connections to the server are already idle.
+*/
+
+static void pool_release( pool_link link, int broken )
+{
+	if ( !broken && mvcp_remote_check( link->parser ) == 0 )
+	{
+		pool_link ptr = NULL;
+		int count = 0;
+
+		pthread_mutex_lock( &pool_mutex );
+		for ( ptr = pool; ptr != NULL; ptr = ptr->next )
+			count += !strcmp( ptr->key, link->key );
+		if ( count < POOL_MAX )
+		{
+			if ( !pool_registered )
+			{
+				mlt_factory_register_for_clean_up( &pool, pool_close );
+				pool_registered = 1;
+			}
+			link->next = pool;
+			pool = link;
+			link = NULL;
+		}
+		pthread_mutex_unlock( &pool_mutex );
+	}
+
+	if ( link != NULL )
+		pool_link_close( link );
+}
+
 static int consumer_start( mlt_consumer this )
 {
 	// Get the producer service
@@ -93,6 +225,9 @@ static int consumer_start( mlt_consumer this )
 	// If this is a reuse, then a mvcp object will exist
 	mvcp connection = mlt_properties_get_data( properties, "connection", NULL );
 
+	// Connections are shared with other consumers unless pooling is off
+	int pooled = mlt_properties_get_int( properties, "pool" );
+
 	// Special case - we can get a doc too...
 	char *doc = mlt_properties_get( properties, "xml" );
 
@@ -116,10 +251,22 @@ static int consumer_start( mlt_consumer this )
 
 	if ( service != NULL || doc != NULL )
 	{
-		// Initiate the connection if required
-		if ( connection == NULL )
+		pool_link link = NULL;
+		int error = mvcp_ok;
+
+		// Take a connection from the pool when pooling, otherwise initiate one if required
+		if ( pooled )
+		{
+			link = pool_acquire( server, port );
+			if ( link != NULL )
+				connection = link->connection;
+			else
+				fprintf( stderr, "Unable to connect to the server at %s:%d\n", server, port );
+		}
+		else if ( connection == NULL )
 		{
 			mvcp_parser parser = mvcp_parser_init_remote( server, port );
+			mvcp_remote_set_silent( parser, 1 );
 			connection = mvcp_init( parser );
 			if ( mvcp_connect( connection ) == mvcp_ok )
 			{
@@ -129,20 +276,20 @@ static int consumer_start( mlt_consumer this )
 			else
 			{
 				fprintf( stderr, "Unable to connect to the server at %s:%d\n", server, port );
-				mlt_properties_set_int( properties, "_error", 1 );
 				mvcp_close( connection );
 				mvcp_parser_close( parser );
 				connection = NULL;
 			}
 		}
 
+		if ( connection == NULL )
+			mlt_properties_set_int( properties, "_error", 1 );
+
 		// If we have connection, push the service over
 		if ( connection != NULL )
 		{
 			if ( doc == NULL )
 			{
-				int error;
-
 				// Push the service
 				error = mvcp_unit_push( connection, unit, command, service );
 
@@ -153,13 +300,17 @@ static int consumer_start( mlt_consumer this )
 			else
 			{
 				// Push the service
-				int error = mvcp_unit_receive( connection, unit, command, doc );
+				error = mvcp_unit_receive( connection, unit, command, doc );
 
 				// Report error
 				if ( error != mvcp_ok )
 					fprintf( stderr, "Send failed on %s:%d %s u%d (%d)\n", server, port, command, unit, error );
 			}
 		}
+
+		// Hand the connection back for the next consumer - a response which never came leaves it unusable
+		if ( link != NULL )
+			pool_release( link, error == mvcp_server_unavailable || error == mvcp_no_response );
 	}
 	
 	mlt_consumer_stop( this );
@@ -95,19 +95,40 @@ client client_init( mvcp_parser parser )
 	client this = malloc( sizeof( client_t ) );
 	if ( this != NULL )
 	{
-		int index = 0;
 		memset( this, 0, sizeof( client_t ) );
 		strcpy( this->last_directory, "/" );
-		for ( index = 0; index < 4; index ++ )
-		{
-			this->queues[ index ].unit = index;
-			this->queues[ index ].position = -1;
-		}
+		pthread_mutex_init( &this->mutex, NULL );
 		this->parser = parser;
 	}
 	return this;
 }
 
+/** Get the queue for a unit - queues are allocated as units are used.
+*/
+
+client_queue client_get_queue( client demo, int unit )
+{
+	client_queue queue = NULL;
+
+	if ( unit >= 0 && unit < MAX_UNITS )
+	{
+		pthread_mutex_lock( &demo->mutex );
+		if ( demo->queues[ unit ] == NULL )
+		{
+			demo->queues[ unit ] = calloc( 1, sizeof( client_queue_t ) );
+			if ( demo->queues[ unit ] != NULL )
+			{
+				demo->queues[ unit ]->unit = unit;
+				demo->queues[ unit ]->position = -1;
+			}
+		}
+		queue = demo->queues[ unit ];
+		pthread_mutex_unlock( &demo->mutex );
+	}
+
+	return queue;
+}
+
 /** Display a status record.
 */
 
@@ -160,7 +181,10 @@ void client_show_status( client demo, mvcp_status status )
 
 void client_queue_action( client demo, mvcp_status status )
 {
-	client_queue queue = &demo->queues[ status->unit ];
+	client_queue queue = client_get_queue( demo, status->unit );
+
+	if ( queue == NULL )
+		return;
 
 	/* SPECIAL CASE STATUS NOTIFICATIONS TO IGNORE */
 
@@ -614,7 +638,7 @@ mvcp_error_code client_load( client demo )
 				if ( refresh )
 				{
 					const char *action = "Load & Play";
-					if ( demo->queues[ demo->selected_unit ].mode )
+					if ( client_get_queue( demo, demo->selected_unit )->mode )
 						action = "Queue";
 					printf( "%s from %s\n\n", action, demo->current_directory );
 					if ( strcmp( demo->current_directory, "/" ) )
@@ -690,7 +714,7 @@ mvcp_error_code client_load( client demo )
 					case 'q':
 						client_change_status( demo, 0 );
 						term_exit( );
-						client_queue_maintenance( demo, &demo->queues[ demo->selected_unit ] );
+						client_queue_maintenance( demo, client_get_queue( demo, demo->selected_unit ) );
 						term_init( );
 						selected = 1;
 						break;
@@ -715,14 +739,14 @@ mvcp_error_code client_load( client demo )
 
 		if ( !terminated && demo->current_directory[ strlen( demo->current_directory ) - 1 ] != '/' )
 		{
-			if ( demo->queues[ demo->selected_unit ].mode == 0 )
+			if ( client_get_queue( demo, demo->selected_unit )->mode == 0 )
 			{
 				error = mvcp_unit_load( demo->dv, demo->selected_unit, demo->current_directory );
 				mvcp_unit_play( demo->dv, demo->selected_unit );
 			}
 			else
 			{
-				client_queue_add( demo, &demo->queues[ demo->selected_unit ], demo->current_directory );
+				client_queue_add( demo, client_get_queue( demo, demo->selected_unit ), demo->current_directory );
 				printf( "File %s added to queue.\n", demo->current_directory );
 			}
 			strcpy( demo->current_directory, demo->last_directory );
@@ -913,7 +937,7 @@ mvcp_error_code client_transport( client demo )
 			case 'q':
 				client_change_status( demo, 0 );
 				term_exit( );
-				client_queue_maintenance( demo, &demo->queues[ demo->selected_unit ] );
+				client_queue_maintenance( demo, client_get_queue( demo, demo->selected_unit ) );
 				refresh = 1;
 				break;
 		}
@@ -1019,5 +1043,9 @@ void client_run( client this )
 
 void client_close( client demo )
 {
+	int index = 0;
+	for ( index = 0; index < MAX_UNITS; index ++ )
+		free( demo->queues[ index ] );
+	pthread_mutex_destroy( &demo->mutex );
 	free( demo );
 }
@@ -54,11 +54,13 @@ typedef struct
 	int showing;
 	int terminated;
 	pthread_t thread;
-	client_queue_t queues[ MAX_UNITS ];
+	pthread_mutex_t mutex;
+	client_queue queues[ MAX_UNITS ];
 }
 *client, client_t;
 
 extern client client_init( mvcp_parser );
+extern client_queue client_get_queue( client, int );
 extern void client_run( client );
 extern void client_close( client );
 
@@ -145,6 +145,33 @@ mvcp_error_code mvcp_execute( mvcp this, size_t size, const char *format, ... )
 	return error;
 }
 
+/** Submit a command without waiting for its response, which is passed to the
+	completion (and is owned by it). Only a pipelined remote parser returns
+	before the response arrives - otherwise this behaves like mvcp_execute.
+*/
+
+mvcp_error_code mvcp_submit( mvcp this, mvcp_completion completion, void *data, size_t size, const char *format, ... )
+{
+	mvcp_error_code error = mvcp_server_unavailable;
+	char *command = malloc( size );
+	if ( this != NULL && command != NULL )
+	{
+		va_list list;
+		va_start( list, format );
+		if ( vsnprintf( command, size, format, list ) != 0 )
+			error = mvcp_parser_submit( this->parser, command, completion, data ) == 0 ? mvcp_ok : mvcp_server_unavailable;
+		else
+			error = mvcp_invalid_command;
+		va_end( list );
+	}
+	else
+	{
+		error = mvcp_malloc_failed;
+	}
+	free( command );
+	return error;
+}
+
 /** Execute a command.
 */
 
@@ -330,6 +357,15 @@ mvcp_error_code mvcp_unit_push( mvcp this, int unit, char *command, mlt_service
 	return mvcp_push( this, service, 10240, "PUSH U%d %s", unit, command );
 }
 
+/** Apply a batch of playlist changes to a unit - the body holds one APND,
+	INSERT, REMOVE or MOVE command per line without the unit argument.
+*/
+
+mvcp_error_code mvcp_unit_batch( mvcp this, int unit, char *body )
+{
+	return mvcp_receive( this, body, 1024, "BATCH U%d", unit );
+}
+
 /** Clean the unit - this function removes all but the currently playing clip.
 */
 
@@ -605,6 +641,65 @@ mvcp_dir mvcp_dir_init( mvcp this, const char *directory )
 	return dir;
 }
 
+/** Fetch a page of a directory opened with mvcp_dir_open.
+*/
+
+static void mvcp_dir_fetch( mvcp_dir dir )
+{
+	const char *space = dir->options[ 0 ] != '\0' ? " " : "";
+	mvcp_response_close( dir->response );
+	if ( dir->page > 0 )
+		dir->response = mvcp_parser_executef( dir->client->parser, "CLS \"%s\" offset=%d limit=%d%s%s",
+			dir->directory, dir->offset, dir->page, space, dir->options );
+	else
+		dir->response = mvcp_parser_executef( dir->client->parser, "CLS \"%s\"%s%s", dir->directory, space, dir->options );
+	dir->index = 0;
+}
+
+/** Open a directory to be read a page at a time with mvcp_dir_next. The
+	options are passed on to CLS (eg: "match=*.dv sort=-mtime") and page is
+	the number of entries to fetch at a time (0 fetches them all at once).
+*/
+
+mvcp_dir mvcp_dir_open( mvcp this, const char *directory, const char *options, int page )
+{
+	mvcp_dir dir = calloc( 1, sizeof( mvcp_dir_t ) );
+	if ( dir != NULL )
+	{
+		dir->directory = strdup( directory );
+		dir->options = strdup( options != NULL ? options : "" );
+		dir->client = this;
+		dir->page = page;
+		mvcp_dir_fetch( dir );
+	}
+	return dir;
+}
+
+/** Get the next entry of a directory opened with mvcp_dir_open, fetching
+	the next page from the server as needed. Returns 1 when an entry was
+	obtained, 0 at the end of the directory and -1 on error.
+*/
+
+int mvcp_dir_next( mvcp_dir dir, mvcp_dir_entry entry )
+{
+	if ( dir == NULL || dir->client == NULL || mvcp_dir_count( dir ) < 0 )
+		return -1;
+
+	if ( dir->index >= mvcp_dir_count( dir ) )
+	{
+		if ( dir->page <= 0 || mvcp_dir_count( dir ) < dir->page )
+			return 0;
+		dir->offset += mvcp_dir_count( dir );
+		mvcp_dir_fetch( dir );
+		if ( mvcp_dir_count( dir ) < 0 )
+			return -1;
+		if ( mvcp_dir_count( dir ) == 0 )
+			return 0;
+	}
+
+	return mvcp_dir_get( dir, dir->index ++, entry ) == mvcp_ok ? 1 : -1;
+}
+
 /** Return the error code associated to the dir.
 */
 
@@ -675,6 +770,7 @@ void mvcp_dir_close( mvcp_dir dir )
 	if ( dir != NULL )
 	{
 		free( dir->directory );
+		free( dir->options );
 		mvcp_response_close( dir->response );
 		free( dir );
 	}
@@ -688,6 +784,7 @@ mvcp_list mvcp_list_init( mvcp this, int unit )
 	mvcp_list list = calloc( 1, sizeof( mvcp_list_t ) );
 	if ( list != NULL )
 	{
+		list->unit = unit;
 		list->response = mvcp_parser_executef( this->parser, "LIST U%d", unit );
 		if ( mvcp_response_count( list->response ) >= 2 )
 			list->generation = atoi( mvcp_response_get_line( list->response, 1 ) );
@@ -695,6 +792,73 @@ mvcp_list mvcp_list_init( mvcp this, int unit )
 	return list;
 }
 
+/** Bring the list up to date, fetching only the entries which have changed
+	since the list was last obtained from the server.
+*/
+
+mvcp_error_code mvcp_list_refresh( mvcp this, mvcp_list list )
+{
+	mvcp_error_code error = mvcp_malloc_failed;
+	mvcp_response response = NULL;
+
+	if ( list == NULL || mvcp_list_count( list ) < 0 )
+		return error;
+
+	response = mvcp_parser_executef( this->parser, "LIST U%d %d", list->unit, list->generation );
+	error = mvcp_get_error_code( NULL, response );
+
+	if ( error == mvcp_ok && mvcp_response_count( response ) >= 3 )
+	{
+		int changed = mvcp_response_count( response ) - 3;
+		int generation = 0;
+		int count = changed;
+		int first = 0;
+		int fields = sscanf( mvcp_response_get_line( response, 1 ), "%d %d %d", &generation, &count, &first );
+
+		/* A server without incremental listing replies with the full list */
+		if ( fields == 1 )
+		{
+			count = changed;
+			first = 0;
+		}
+
+		if ( fields != 1 && fields != 3 )
+		{
+			error = mvcp_unknown_error;
+		}
+		else if ( first <= mvcp_list_count( list ) && first + changed == count )
+		{
+			mvcp_response merged = mvcp_response_init( );
+			int i;
+
+			mvcp_response_write( merged, mvcp_response_get_line( response, 0 ), mvcp_response_get_length( response, 0 ) );
+			mvcp_response_printf( merged, 1024, "\n%d\n", generation );
+			for ( i = 0; i < first; i ++ )
+			{
+				mvcp_response_write( merged, mvcp_response_get_line( list->response, i + 2 ), mvcp_response_get_length( list->response, i + 2 ) );
+				mvcp_response_write( merged, "\n", 1 );
+			}
+			for ( i = 0; i < changed; i ++ )
+			{
+				mvcp_response_write( merged, mvcp_response_get_line( response, i + 2 ), mvcp_response_get_length( response, i + 2 ) );
+				mvcp_response_write( merged, "\n", 1 );
+			}
+			mvcp_response_write( merged, "\n", 1 );
+
+			mvcp_response_close( list->response );
+			list->response = merged;
+			list->generation = generation;
+		}
+		else
+		{
+			error = mvcp_unknown_error;
+		}
+	}
+
+	mvcp_response_close( response );
+	return error;
+}
+
 /** Return the error code associated to the list.
 */
 
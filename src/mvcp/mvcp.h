@@ -103,6 +103,7 @@ extern mvcp_error_code mvcp_unit_load_back_clipped( mvcp, int, char *, int32_t,
 extern mvcp_error_code mvcp_unit_append( mvcp, int, char *, int32_t, int32_t );
 extern mvcp_error_code mvcp_unit_receive( mvcp, int, char *, char * );
 extern mvcp_error_code mvcp_unit_push( mvcp, int, char *, mlt_service );
+extern mvcp_error_code mvcp_unit_batch( mvcp, int, char * );
 extern mvcp_error_code mvcp_unit_clean( mvcp, int );
 extern mvcp_error_code mvcp_unit_wipe( mvcp, int );
 extern mvcp_error_code mvcp_unit_clear( mvcp, int );
@@ -141,6 +142,11 @@ typedef struct
 {
 	char *directory;
 	mvcp_response response;
+	mvcp client;
+	char *options;
+	int page;
+	int offset;
+	int index;
 }
 *mvcp_dir, mvcp_dir_t;
 
@@ -163,6 +169,10 @@ extern mvcp_error_code mvcp_dir_get( mvcp_dir, int, mvcp_dir_entry );
 extern int mvcp_dir_count( mvcp_dir );
 extern void mvcp_dir_close( mvcp_dir );
 
+/* Paged directory reading. */
+extern mvcp_dir mvcp_dir_open( mvcp, const char *, const char *, int );
+extern int mvcp_dir_next( mvcp_dir, mvcp_dir_entry );
+
 /** Structure for the list.
 */
 
@@ -170,6 +180,7 @@ typedef struct
 {
 	int generation;
 	mvcp_response response;
+	int unit;
 }
 *mvcp_list, mvcp_list_t;
 
@@ -190,6 +201,7 @@ typedef struct
 
 /* List reading. */
 extern mvcp_list mvcp_list_init( mvcp, int );
+extern mvcp_error_code mvcp_list_refresh( mvcp, mvcp_list );
 extern mvcp_error_code mvcp_list_get_error_code( mvcp_list );
 extern mvcp_error_code mvcp_list_get( mvcp_list, int, mvcp_list_entry );
 extern int mvcp_list_count( mvcp_list );
@@ -257,6 +269,7 @@ extern const char *mvcp_error_description( mvcp_error_code );
 /* Courtesy functions. */
 extern mvcp_error_code mvcp_execute( mvcp, size_t, const char *, ... );
 extern mvcp_error_code mvcp_push( mvcp, mlt_service, size_t, const char *, ... );
+extern mvcp_error_code mvcp_submit( mvcp, mvcp_completion, void *, size_t, const char *, ... );
 
 /* Close function. */
 extern void mvcp_close( mvcp );
@@ -27,6 +27,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 /* Application header files */
@@ -40,28 +43,228 @@ mvcp_notifier mvcp_notifier_init( )
 	mvcp_notifier this = calloc( 1, sizeof( mvcp_notifier_t ) );
 	if ( this != NULL )
 	{
-		int index = 0;
 		pthread_mutex_init( &this->mutex, NULL );
 		pthread_cond_init( &this->cond, NULL );
-		for ( index = 0; index < MAX_UNITS; index ++ )
-			this->store[ index ].unit = index;
 	}
 	return this;
 }
 
+/** Locate the stored status of a unit, allocating its block if asked to.
+	Blocks never move once allocated, so lookups need no lock.
+*/
+
+static mvcp_notifier_unit_t *mvcp_notifier_unit( mvcp_notifier this, int unit, int create )
+{
+	mvcp_notifier_unit_t *block = NULL;
+
+	if ( unit < 0 || unit >= MAX_UNITS )
+		return NULL;
+
+	block = this->blocks[ unit / MVCP_NOTIFIER_BLOCK ];
+	if ( block == NULL && create )
+	{
+		pthread_mutex_lock( &this->mutex );
+		block = this->blocks[ unit / MVCP_NOTIFIER_BLOCK ];
+		if ( block == NULL )
+		{
+			block = calloc( MVCP_NOTIFIER_BLOCK, sizeof( mvcp_notifier_unit_t ) );
+			if ( block != NULL )
+			{
+				int index = 0;
+				for ( index = 0; index < MVCP_NOTIFIER_BLOCK; index ++ )
+				{
+					pthread_mutex_init( &block[ index ].mutex, NULL );
+					block[ index ].status.unit = unit - unit % MVCP_NOTIFIER_BLOCK + index;
+				}
+				__sync_synchronize( );
+				this->blocks[ unit / MVCP_NOTIFIER_BLOCK ] = block;
+			}
+		}
+		pthread_mutex_unlock( &this->mutex );
+	}
+
+	if ( block != NULL && create )
+	{
+		int count = this->count;
+		while ( count <= unit && !__sync_bool_compare_and_swap( &this->count, count, unit + 1 ) )
+			count = this->count;
+	}
+
+	return block != NULL ? &block[ unit % MVCP_NOTIFIER_BLOCK ] : NULL;
+}
+
+/** Get the number of units which have had a status - units above this are
+	unknown.
+*/
+
+int mvcp_notifier_count( mvcp_notifier this )
+{
+	return this->count;
+}
+
+/** Get a stored status record for the specified unit.
+*/
+
+void mvcp_notifier_get_record( mvcp_notifier this, mvcp_status_record record, int unit )
+{
+	mvcp_notifier_unit_t *stored = mvcp_notifier_unit( this, unit, 0 );
+	if ( stored != NULL )
+	{
+		pthread_mutex_lock( &stored->mutex );
+		mvcp_status_record_copy( record, &stored->status );
+		pthread_mutex_unlock( &stored->mutex );
+	}
+	else
+	{
+		mvcp_status_record_clear( record );
+	}
+	record->unit = unit;
+	record->dummy = time( NULL );
+}
+
 /** Get a stored status for the specified unit.
 */
 
 void mvcp_notifier_get( mvcp_notifier this, mvcp_status status, int unit )
 {
-	pthread_mutex_lock( &this->mutex );
-	if ( unit >= 0 && unit < MAX_UNITS )
-		mvcp_status_copy( status, &this->store[ unit ] );
+	mvcp_status_record_t record;
+	memset( &record, 0, sizeof( record ) );
+	mvcp_notifier_get_record( this, &record, unit );
+	mvcp_status_unpack( status, &record );
+	mvcp_status_record_clear( &record );
+}
+
+/** Read the event for the cursor from the ring. Returns 0 when the event was
+	copied, 1 when it hasn't been completed yet and -1 when it has already
+	been overwritten.
+
+	The titles are referenced under the title read lock, so the writer of the
+	slot can't free them between the copy and the check of the sequence.
+*/
+
+static int mvcp_notifier_read( mvcp_notifier this, unsigned long cursor, mvcp_status_record record )
+{
+	mvcp_notifier_slot_t *slot = &this->ring[ cursor & ( MVCP_NOTIFIER_RING - 1 ) ];
+	unsigned long expected = 2 * cursor + 2;
+	unsigned long sequence = slot->sequence;
+	long difference = ( long )( sequence - expected );
+	mvcp_status_record_t copy;
+	int result = 0;
+
+	__sync_synchronize( );
+
+	if ( difference < 0 )
+		return ( long )( this->head - cursor ) > MVCP_NOTIFIER_RING ? -1 : 1;
+	else if ( difference > 0 )
+		return -1;
+
+	mvcp_title_read_lock( );
+	copy = slot->status;
+	__sync_synchronize( );
+	if ( slot->sequence != sequence )
+	{
+		result = -1;
+	}
+	else if ( !mvcp_title_try_ref( copy.clip ) )
+	{
+		result = -1;
+	}
+	else if ( !mvcp_title_try_ref( copy.tail_clip ) )
+	{
+		result = -2;
+	}
+	mvcp_title_read_unlock( );
+
+	/* Releasing may free the title, which needs the write lock */
+	if ( result == -2 )
+	{
+		mvcp_title_release( copy.clip );
+		result = -1;
+	}
+	else if ( result == 0 )
+	{
+		mvcp_status_record_clear( record );
+		*record = copy;
+	}
+
+	return result;
+}
+
+/** Obtain a cursor positioned after the most recent status event.
+*/
+
+unsigned long mvcp_notifier_subscribe( mvcp_notifier this )
+{
+	__sync_synchronize( );
+	return this->head;
+}
+
+/** Fetch the next status event for a subscriber, waiting up to timeout
+	milliseconds for one to arrive.
+
+	Returns 0 when the record has been filled in and the cursor advanced, and
+	ETIMEDOUT if nothing arrived. If the subscriber has fallen so far behind
+	that events were overwritten, -1 is returned and the cursor moved to the
+	current position - the subscriber should then refresh every unit with
+	mvcp_notifier_get_record.
+*/
+
+int mvcp_notifier_next_record( mvcp_notifier this, unsigned long *cursor, mvcp_status_record record, int timeout )
+{
+	int result = mvcp_notifier_read( this, *cursor, record );
+
+	if ( result == 1 && timeout > 0 )
+	{
+		struct timeval now;
+		struct timespec until;
+		int error = 0;
+
+		gettimeofday( &now, NULL );
+		until.tv_sec = now.tv_sec + timeout / 1000;
+		until.tv_nsec = ( now.tv_usec + ( timeout % 1000 ) * 1000 ) * 1000;
+		if ( until.tv_nsec >= 1000000000 )
+		{
+			until.tv_sec ++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_mutex_lock( &this->mutex );
+		__sync_fetch_and_add( &this->waiters, 1 );
+		while ( !error && ( result = mvcp_notifier_read( this, *cursor, record ) ) == 1 )
+			error = pthread_cond_timedwait( &this->cond, &this->mutex, &until );
+		__sync_fetch_and_sub( &this->waiters, 1 );
+		pthread_mutex_unlock( &this->mutex );
+	}
+
+	if ( result == 0 )
+	{
+		*cursor += 1;
+	}
+	else if ( result == -1 )
+	{
+		*cursor = mvcp_notifier_subscribe( this );
+	}
 	else
-		memset( status, 0, sizeof( mvcp_status_t ) );
-	status->unit = unit;
-	status->dummy = time( NULL );
-	pthread_mutex_unlock( &this->mutex );
+	{
+		mvcp_status_record_clear( record );
+		result = ETIMEDOUT;
+	}
+
+	return result;
+}
+
+/** Fetch the next status event for a subscriber as a status structure.
+*/
+
+int mvcp_notifier_next( mvcp_notifier this, unsigned long *cursor, mvcp_status status, int timeout )
+{
+	mvcp_status_record_t record;
+	int result = 0;
+	memset( &record, 0, sizeof( record ) );
+	result = mvcp_notifier_next_record( this, cursor, &record, timeout );
+	mvcp_status_unpack( status, &record );
+	mvcp_status_record_clear( &record );
+	return result;
 }
 
 /** Wait on a new status.
@@ -69,21 +272,75 @@ void mvcp_notifier_get( mvcp_notifier this, mvcp_status status, int unit )
 
 int mvcp_notifier_wait( mvcp_notifier this, mvcp_status status )
 {
-	struct timeval now;
-	struct timespec timeout;
-	int error = 0;
+	unsigned long cursor = mvcp_notifier_subscribe( this );
+	int error = mvcp_notifier_next( this, &cursor, status, 1000 );
+	return error == -1 ? ETIMEDOUT : error;
+}
 
-	memset( status, 0, sizeof( mvcp_status_t ) );
-	gettimeofday( &now, NULL );
-	timeout.tv_sec = now.tv_sec + 1;
-	timeout.tv_nsec = now.tv_usec * 1000;
-	pthread_mutex_lock( &this->mutex );
-	error = pthread_cond_timedwait( &this->cond, &this->mutex, &timeout );
-	if ( !error )
-		mvcp_status_copy( status, &this->last );
-	pthread_mutex_unlock( &this->mutex );
+/** Put a new status record.
+
+	The unit's stored status is updated under its own lock and the event is
+	then written to the next slot of the ring - producers for different units
+	never contend and subscribers don't block producers. The notifier mutex
+	is only taken when a thread is blocked waiting for the event or a watch
+	is armed for it - busy subscribers are disarmed and cost nothing.
+*/
+
+void mvcp_notifier_put_record( mvcp_notifier this, mvcp_status_record record )
+{
+	mvcp_notifier_slot_t *slot = NULL;
+	unsigned long ticket = 0;
+	unsigned long previous = 0;
+	mvcp_title clip = NULL;
+	mvcp_title tail_clip = NULL;
+	mvcp_notifier_unit_t *stored = mvcp_notifier_unit( this, record->unit, 1 );
+
+	if ( stored == NULL )
+		return;
+
+	/* Taking the ticket under the unit lock keeps events for a unit in store order */
+	pthread_mutex_lock( &stored->mutex );
+	mvcp_status_record_copy( &stored->status, record );
+	ticket = __sync_fetch_and_add( &this->head, 1 );
+	pthread_mutex_unlock( &stored->mutex );
+
+	/* The writer of the previous lap must be done with the slot before its titles are released */
+	slot = &this->ring[ ticket & ( MVCP_NOTIFIER_RING - 1 ) ];
+	previous = ticket < MVCP_NOTIFIER_RING ? 0 : 2 * ( ticket - MVCP_NOTIFIER_RING ) + 2;
+	while ( slot->sequence != previous )
+		sched_yield( );
 
-	return error;
+	slot->sequence = 2 * ticket + 1;
+	__sync_synchronize( );
+	clip = slot->status.clip;
+	tail_clip = slot->status.tail_clip;
+	slot->status = *record;
+	mvcp_title_ref( record->clip );
+	mvcp_title_ref( record->tail_clip );
+	__sync_synchronize( );
+	slot->sequence = 2 * ticket + 2;
+	__sync_synchronize( );
+
+	mvcp_title_release( clip );
+	mvcp_title_release( tail_clip );
+
+	if ( this->waiters || this->armed )
+	{
+		mvcp_notifier_watch watch = NULL;
+		pthread_mutex_lock( &this->mutex );
+		if ( this->waiters )
+			pthread_cond_broadcast( &this->cond );
+		for ( watch = this->watches; watch != NULL && this->armed; watch = watch->next )
+		{
+			/* A full pipe already has a byte waiting */
+			if ( watch->armed && ( write( watch->fd, "", 1 ) >= 0 || errno == EAGAIN ) )
+			{
+				watch->armed = 0;
+				__sync_fetch_and_sub( &this->armed, 1 );
+			}
+		}
+		pthread_mutex_unlock( &this->mutex );
+	}
 }
 
 /** Put a new status.
@@ -91,11 +348,11 @@ int mvcp_notifier_wait( mvcp_notifier this, mvcp_status status )
 
 void mvcp_notifier_put( mvcp_notifier this, mvcp_status status )
 {
-	pthread_mutex_lock( &this->mutex );
-	mvcp_status_copy( &this->store[ status->unit ], status );
-	mvcp_status_copy( &this->last, status );
-	pthread_cond_broadcast( &this->cond );
-	pthread_mutex_unlock( &this->mutex );
+	mvcp_status_record_t record;
+	memset( &record, 0, sizeof( record ) );
+	mvcp_status_pack( &record, status );
+	mvcp_notifier_put_record( this, &record );
+	mvcp_status_record_clear( &record );
 }
 
 /** Communicate a disconnected status for all units to all waiting.
@@ -104,12 +361,73 @@ void mvcp_notifier_put( mvcp_notifier this, mvcp_status status )
 void mvcp_notifier_disconnected( mvcp_notifier notifier )
 {
 	int unit = 0;
-	mvcp_status_t status;
-	for ( unit = 0; unit < MAX_UNITS; unit ++ )
+	mvcp_status_record_t record;
+	memset( &record, 0, sizeof( record ) );
+	for ( unit = 0; unit < mvcp_notifier_count( notifier ); unit ++ )
+	{
+		mvcp_notifier_get_record( notifier, &record, unit );
+		record.status = unit_disconnected;
+		mvcp_notifier_put_record( notifier, &record );
+	}
+	mvcp_status_record_clear( &record );
+}
+
+/** Register a descriptor (typically the non-blocking write end of a pipe)
+	to be written to when status events arrive. The watch starts armed.
+*/
+
+mvcp_notifier_watch mvcp_notifier_watch_init( mvcp_notifier this, int fd )
+{
+	mvcp_notifier_watch watch = calloc( 1, sizeof( mvcp_notifier_watch_t ) );
+	if ( watch != NULL )
+	{
+		watch->fd = fd;
+		watch->armed = 1;
+		pthread_mutex_lock( &this->mutex );
+		watch->next = this->watches;
+		this->watches = watch;
+		__sync_fetch_and_add( &this->armed, 1 );
+		pthread_mutex_unlock( &this->mutex );
+	}
+	return watch;
+}
+
+/** Arm the watch for the next status event. Events which arrived before
+	this are not signalled, so subscribers should arm before they catch up.
+*/
+
+void mvcp_notifier_watch_arm( mvcp_notifier this, mvcp_notifier_watch watch )
+{
+	pthread_mutex_lock( &this->mutex );
+	if ( !watch->armed )
 	{
-		mvcp_notifier_get( notifier, &status, unit );
-		status.status = unit_disconnected;
-		mvcp_notifier_put( notifier, &status );
+		watch->armed = 1;
+		__sync_fetch_and_add( &this->armed, 1 );
+	}
+	pthread_mutex_unlock( &this->mutex );
+}
+
+/** Remove and free the watch - the descriptor is left open.
+*/
+
+void mvcp_notifier_watch_close( mvcp_notifier this, mvcp_notifier_watch watch )
+{
+	if ( watch != NULL )
+	{
+		mvcp_notifier_watch *link = NULL;
+		pthread_mutex_lock( &this->mutex );
+		for ( link = &this->watches; *link != NULL; link = &( *link )->next )
+		{
+			if ( *link == watch )
+			{
+				*link = watch->next;
+				if ( watch->armed )
+					__sync_fetch_and_sub( &this->armed, 1 );
+				break;
+			}
+		}
+		pthread_mutex_unlock( &this->mutex );
+		free( watch );
 	}
 }
 
@@ -120,6 +438,20 @@ void mvcp_notifier_close( mvcp_notifier this )
 {
 	if ( this != NULL )
 	{
+		int index = 0;
+		for ( index = 0; index < MAX_UNITS / MVCP_NOTIFIER_BLOCK; index ++ )
+		{
+			mvcp_notifier_unit_t *block = this->blocks[ index ];
+			int unit = 0;
+			for ( unit = 0; block != NULL && unit < MVCP_NOTIFIER_BLOCK; unit ++ )
+			{
+				mvcp_status_record_clear( &block[ unit ].status );
+				pthread_mutex_destroy( &block[ unit ].mutex );
+			}
+			free( block );
+		}
+		for ( index = 0; index < MVCP_NOTIFIER_RING; index ++ )
+			mvcp_status_record_clear( &this->ring[ index ].status );
 		pthread_mutex_destroy( &this->mutex );
 		pthread_cond_destroy( &this->cond );
 		free( this );
@@ -32,7 +32,56 @@ extern "C"
 {
 #endif
 
-#define MAX_UNITS 16
+/** Highest number of units - unit state is allocated in blocks as units are
+	used, so this only sizes the block directory.
+*/
+
+#define MAX_UNITS 1024
+
+/** Number of units in a block of unit state.
+*/
+
+#define MVCP_NOTIFIER_BLOCK 16
+
+/** Number of status events held for subscribers (a power of 2).
+*/
+
+#define MVCP_NOTIFIER_RING 1024
+
+/** A status event in the ring. The sequence is odd while the slot is being
+	written and 2 * ( ticket + 1 ) once the event for the ticket is complete.
+	The slot holds references to the titles of its record.
+*/
+
+typedef struct
+{
+	volatile unsigned long sequence;
+	mvcp_status_record_t status;
+}
+mvcp_notifier_slot_t;
+
+/** Stored status of a unit.
+*/
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	mvcp_status_record_t status;
+}
+mvcp_notifier_unit_t;
+
+/** A descriptor which is written to when a status event arrives. Once a
+	byte has been written the watch must be armed again to get another.
+	Only armed watches cost a status event anything.
+*/
+
+typedef struct mvcp_notifier_watch_s
+{
+	int fd;
+	int armed;
+	struct mvcp_notifier_watch_s *next;
+}
+*mvcp_notifier_watch, mvcp_notifier_watch_t;
 
 /** Status notifier definition.
 */
@@ -41,16 +90,30 @@ typedef struct
 {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
-	mvcp_status_t last;
-	mvcp_status_t store[ MAX_UNITS ];
+	volatile int waiters;
+	volatile unsigned long head;
+	mvcp_notifier_slot_t ring[ MVCP_NOTIFIER_RING ];
+	volatile int count;
+	mvcp_notifier_unit_t *volatile blocks[ MAX_UNITS / MVCP_NOTIFIER_BLOCK ];
+	mvcp_notifier_watch watches;
+	volatile int armed;
 }
 *mvcp_notifier, mvcp_notifier_t;
 
 extern mvcp_notifier mvcp_notifier_init( );
+extern int mvcp_notifier_count( mvcp_notifier );
 extern void mvcp_notifier_get( mvcp_notifier, mvcp_status, int );
 extern int mvcp_notifier_wait( mvcp_notifier, mvcp_status );
+extern unsigned long mvcp_notifier_subscribe( mvcp_notifier );
+extern int mvcp_notifier_next( mvcp_notifier, unsigned long *, mvcp_status, int );
 extern void mvcp_notifier_put( mvcp_notifier, mvcp_status );
+extern void mvcp_notifier_get_record( mvcp_notifier, mvcp_status_record, int );
+extern int mvcp_notifier_next_record( mvcp_notifier, unsigned long *, mvcp_status_record, int );
+extern void mvcp_notifier_put_record( mvcp_notifier, mvcp_status_record );
 extern void mvcp_notifier_disconnected( mvcp_notifier );
+extern mvcp_notifier_watch mvcp_notifier_watch_init( mvcp_notifier, int );
+extern void mvcp_notifier_watch_arm( mvcp_notifier, mvcp_notifier_watch );
+extern void mvcp_notifier_watch_close( mvcp_notifier, mvcp_notifier_watch );
 extern void mvcp_notifier_close( mvcp_notifier );
 
 #ifdef __cplusplus
@@ -45,6 +45,20 @@ mvcp_response mvcp_parser_execute( mvcp_parser parser, char *command )
 	return parser->execute( parser->real, command );
 }
 
+/** Submit a command without waiting for its response - the completion is
+	called with the response once it arrives. Parsers which can't have more
+	than one command in flight execute it immediately. Returns 0 when the
+	completion will be called and -1 otherwise.
+*/
+
+int mvcp_parser_submit( mvcp_parser parser, char *command, mvcp_completion completion, void *data )
+{
+	if ( parser->submit != NULL )
+		return parser->submit( parser->real, command, completion, data );
+	completion( data, mvcp_parser_execute( parser, command ) );
+	return 0;
+}
+
 /** Push a service via the parser.
 */
 
@@ -46,6 +46,14 @@ typedef mvcp_response (*parser_received)( void *, char *, char * );
 typedef mvcp_response (*parser_push)( void *, char *, mlt_service );
 typedef void (*parser_close)( void * );
 
+/** Callback receiving the response to a command submitted with
+	mvcp_parser_submit - the response is NULL when the command failed and
+	must be closed by the callback.
+*/
+
+typedef void (*mvcp_completion)( void *, mvcp_response );
+typedef int (*parser_submit)( void *, char *, mvcp_completion, void * );
+
 /** Structure for the mvcp parser.
 */
 
@@ -58,6 +66,7 @@ typedef struct
 	parser_close close;
 	void *real;
 	mvcp_notifier notifier;
+	parser_submit submit;
 }
 *mvcp_parser, mvcp_parser_t;
 
@@ -68,6 +77,7 @@ extern mvcp_response mvcp_parser_connect( mvcp_parser );
 extern mvcp_response mvcp_parser_push( mvcp_parser, char *, mlt_service );
 extern mvcp_response mvcp_parser_received( mvcp_parser, char *, char * );
 extern mvcp_response mvcp_parser_execute( mvcp_parser, char * );
+extern int mvcp_parser_submit( mvcp_parser, char *, mvcp_completion, void * );
 extern mvcp_response mvcp_parser_executef( mvcp_parser, const char *, ... );
 extern mvcp_response mvcp_parser_run_file( mvcp_parser parser, FILE *file );
 extern mvcp_response mvcp_parser_run( mvcp_parser, char * );
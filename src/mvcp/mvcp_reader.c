@@ -0,0 +1,279 @@
+/*
+ * mvcp_reader.c -- Buffered Line Reader
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* System header files */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+/* Application header files */
+#include "mvcp_reader.h"
+
+/** Initialise a reader on a connected file descriptor. A size of 0 gives the
+	default buffer size.
+*/
+
+mvcp_reader mvcp_reader_init( int fd, int size )
+{
+	mvcp_reader reader = malloc( sizeof( mvcp_reader_t ) );
+	if ( reader != NULL )
+	{
+		memset( reader, 0, sizeof( mvcp_reader_t ) );
+		reader->fd = fd;
+		reader->size = size > 0 ? size : MVCP_READER_SIZE;
+		reader->buffer = malloc( reader->size );
+		if ( reader->buffer == NULL )
+		{
+			free( reader );
+			reader = NULL;
+		}
+	}
+	return reader;
+}
+
+/** Wait for a non-blocking descriptor to become readable. Returns 0 when
+	reading should be retried and -1 otherwise.
+*/
+
+static int mvcp_reader_wait( mvcp_reader reader )
+{
+	struct pollfd pfd;
+	int result = 0;
+
+	if ( errno != EAGAIN && errno != EWOULDBLOCK )
+		return -1;
+
+	pfd.fd = reader->fd;
+	pfd.events = POLLIN;
+	do
+		result = poll( &pfd, 1, -1 );
+	while ( result < 0 && errno == EINTR );
+
+	return result > 0 ? 0 : -1;
+}
+
+/** Pull whatever the descriptor has into the buffer with a single read.
+
+	Returns the number of bytes read, 0 at end of file and -1 on error (errno
+	is preserved, so EAGAIN can be detected on non-blocking descriptors).
+*/
+
+int mvcp_reader_fill( mvcp_reader reader )
+{
+	int count = 0;
+
+	if ( reader->start > 0 )
+	{
+		memmove( reader->buffer, reader->buffer + reader->start, reader->end - reader->start );
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+
+	if ( reader->end == reader->size )
+		return 0;
+
+	do
+		count = read( reader->fd, reader->buffer + reader->end, reader->size - reader->end );
+	while ( count < 0 && errno == EINTR );
+
+	if ( count > 0 )
+		reader->end += count;
+	else if ( count == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) )
+		reader->eof = 1;
+
+	return count;
+}
+
+/** Number of bytes buffered but not yet consumed.
+*/
+
+int mvcp_reader_available( mvcp_reader reader )
+{
+	return reader->end - reader->start;
+}
+
+/** Extract a line from the buffered data without touching the descriptor.
+
+	The rules are those of the old fdgetline: at most max - 1 characters are
+	returned, the '\n' is dropped and a ctrl-D (kept in the line) or end of
+	file sets *eof. Returns 1 when a line was extracted and 0 when more data
+	is needed.
+*/
+
+int mvcp_reader_scan( mvcp_reader reader, char *line, int max, int *eof )
+{
+	char *start = reader->buffer + reader->start;
+	int available = reader->end - reader->start;
+	int limit = max - 1 < available ? max - 1 : available;
+	int count = 0;
+	int consumed = 0;
+
+	*eof = 0;
+
+	while ( count < limit && start[ count ] != '\n' && start[ count ] != 4 )
+		count ++;
+
+	if ( count < limit && start[ count ] == '\n' )
+	{
+		consumed = count + 1;
+	}
+	else if ( count < limit && start[ count ] == 4 )
+	{
+		consumed = ++ count;
+		*eof = 1;
+	}
+	else if ( count == max - 1 || available == reader->size )
+	{
+		consumed = count;
+	}
+	else if ( reader->eof )
+	{
+		consumed = count;
+		*eof = 1;
+	}
+	else
+	{
+		return 0;
+	}
+
+	memcpy( line, start, count );
+	line[ count ] = '\0';
+	reader->start += consumed;
+	if ( reader->start == reader->end )
+		reader->start = reader->end = 0;
+
+	return 1;
+}
+
+/** Return the next complete line in place, without copying it, or NULL when
+	more data is needed. The '\n' (and a '\r' before it) are replaced by NUL.
+	The last line at end of file is returned without its newline. A line
+	which doesn't fit in the buffer can't be returned whole, so the reader is
+	put at end of file and NULL is returned rather than splitting it. The line
+	is valid until the reader is next filled.
+*/
+
+char *mvcp_reader_next( mvcp_reader reader, int *length )
+{
+	char *start = reader->buffer + reader->start;
+	int available = reader->end - reader->start;
+	char *newline = memchr( start, '\n', available );
+	int count = 0;
+
+	if ( newline != NULL )
+	{
+		count = newline - start;
+		reader->start += count + 1;
+	}
+	else if ( available == reader->size )
+	{
+		reader->eof = 1;
+		return NULL;
+	}
+	else if ( available > 0 && reader->eof )
+	{
+		/* Make room for the terminator */
+		if ( reader->end == reader->size )
+		{
+			memmove( reader->buffer, start, available );
+			start = reader->buffer;
+			reader->start = 0;
+			reader->end = available;
+		}
+		count = available;
+		reader->start = reader->end;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	start[ count ] = '\0';
+	if ( count > 0 && start[ count - 1 ] == '\r' )
+		start[ -- count ] = '\0';
+	if ( reader->start == reader->end )
+		reader->start = reader->end = 0;
+	if ( length != NULL )
+		*length = count;
+
+	return start;
+}
+
+/** Blocking read of a line - returns the number of characters in the line.
+*/
+
+int mvcp_reader_get_line( mvcp_reader reader, char *line, int max, int *eof )
+{
+	while ( !mvcp_reader_scan( reader, line, max, eof ) )
+		if ( mvcp_reader_fill( reader ) < 0 && !reader->eof && mvcp_reader_wait( reader ) != 0 )
+			reader->eof = 1;
+	return strlen( line );
+}
+
+/** Copy up to length bytes of already buffered data.
+*/
+
+int mvcp_reader_drain( mvcp_reader reader, char *data, int length )
+{
+	int count = mvcp_reader_available( reader );
+	if ( count > length )
+		count = length > 0 ? length : 0;
+	memcpy( data, reader->buffer + reader->start, count );
+	reader->start += count;
+	if ( reader->start == reader->end )
+		reader->start = reader->end = 0;
+	return count;
+}
+
+/** Blocking read of a block of data. Buffered data is used first and the
+	remainder is read directly into the destination. Returns the number of
+	bytes read, which is less than length at end of file.
+*/
+
+int mvcp_reader_read( mvcp_reader reader, char *data, int length )
+{
+	int total = mvcp_reader_drain( reader, data, length );
+	while ( total < length )
+	{
+		int count = read( reader->fd, data + total, length - total );
+		if ( count > 0 )
+			total += count;
+		else if ( count < 0 && errno == EINTR )
+			continue;
+		else if ( count < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) && mvcp_reader_wait( reader ) == 0 )
+			continue;
+		else
+			break;
+	}
+	return total;
+}
+
+/** Close the reader - the descriptor is left open.
+*/
+
+void mvcp_reader_close( mvcp_reader reader )
+{
+	if ( reader != NULL )
+	{
+		free( reader->buffer );
+		free( reader );
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * mvcp_reader.h -- Buffered Line Reader
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _MVCP_READER_H_
+#define _MVCP_READER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Default size of the reader buffer.
+*/
+
+#define MVCP_READER_SIZE 65536
+
+/** Structure for the buffered reader.
+*/
+
+typedef struct
+{
+	int fd;
+	char *buffer;
+	int size;
+	int start;
+	int end;
+	int eof;
+}
+*mvcp_reader, mvcp_reader_t;
+
+/** Buffered reader API.
+*/
+
+extern mvcp_reader mvcp_reader_init( int, int );
+extern int mvcp_reader_fill( mvcp_reader );
+extern int mvcp_reader_available( mvcp_reader );
+extern int mvcp_reader_scan( mvcp_reader, char *, int, int * );
+extern int mvcp_reader_get_line( mvcp_reader, char *, int, int * );
+extern char *mvcp_reader_next( mvcp_reader, int * );
+extern int mvcp_reader_drain( mvcp_reader, char *, int );
+extern int mvcp_reader_read( mvcp_reader, char *, int );
+extern void mvcp_reader_close( mvcp_reader );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
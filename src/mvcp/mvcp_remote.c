@@ -23,8 +23,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/socket.h>
+#include <poll.h>
 
 /* Application header files */
 #ifndef MVCP_EMBEDDED
@@ -34,10 +37,24 @@
 #endif
 #include "mvcp_remote.h"
 #include "mvcp_socket.h"
-#include "mvcp_tokeniser.h"
-#include "mvcp_util.h"
+#include "mvcp_reader.h"
+
+/** A command awaiting its response in pipelined mode.
+*/
+
+typedef struct mvcp_remote_request_s
+{
+	mvcp_completion completion;
+	void *data;
+	struct mvcp_remote_request_s *next;
+}
+*mvcp_remote_request, mvcp_remote_request_t;
 
 /** Private mvcp_remote structure.
+
+	In pipelined mode, commands are written as they are submitted (the mutex
+	keeps them in order) and queued, and the reader thread matches the
+	responses to the queue in order.
 */
 
 typedef struct
@@ -51,9 +68,36 @@ typedef struct
 	mvcp_parser parser;
 	pthread_mutex_t mutex;
 	int connected;
+	int pipelined;
+	int failed;
+	mvcp_reader reader;
+	pthread_t reader_thread;
+	pthread_mutex_t queue_mutex;
+	pthread_cond_t queue_cond;
+	mvcp_remote_request head;
+	mvcp_remote_request tail;
+	int timeout;
+	int multiplexed;
+	int watching;
+	int listening;
+	int silent;
+	int chunked;
 }
 *mvcp_remote, mvcp_remote_t;
 
+/** A synchronous command waiting on the reader thread.
+*/
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int done;
+	mvcp_response response;
+	mvcp_remote remote;
+}
+mvcp_remote_wait_t;
+
 /** Forward declarations.
 */
 
@@ -61,6 +105,7 @@ static mvcp_response mvcp_remote_connect( mvcp_remote );
 static mvcp_response mvcp_remote_execute( mvcp_remote, char * );
 static mvcp_response mvcp_remote_receive( mvcp_remote, char *, char * );
 static mvcp_response mvcp_remote_push( mvcp_remote, char *, mlt_service );
+static int mvcp_remote_submit( mvcp_remote, char *, mvcp_completion, void * );
 static void mvcp_remote_close( mvcp_remote );
 static int mvcp_remote_read_response( mvcp_socket, mvcp_response );
 
@@ -78,6 +123,7 @@ mvcp_parser mvcp_parser_init_remote( char *server, int port )
 		parser->execute = (parser_execute)mvcp_remote_execute;
 		parser->push = (parser_push)mvcp_remote_push;
 		parser->received = (parser_received)mvcp_remote_receive;
+		parser->submit = (parser_submit)mvcp_remote_submit;
 		parser->close = (parser_close)mvcp_remote_close;
 		parser->real = remote;
 
@@ -86,66 +132,83 @@ mvcp_parser mvcp_parser_init_remote( char *server, int port )
 			remote->parser = parser;
 			remote->server = strdup( server );
 			remote->port = port;
+			remote->timeout = -1;
 			pthread_mutex_init( &remote->mutex, NULL );
+			pthread_mutex_init( &remote->queue_mutex, NULL );
+			pthread_cond_init( &remote->queue_cond, NULL );
 		}
 	}
 	return parser;
 }
 
+/** Parse a status line (full or delta) and hand it to the notifier.
+*/
+
+static void mvcp_remote_status_line( mvcp_notifier notifier, mvcp_status status, char *line )
+{
+	if ( mvcp_status_is_delta( line ) )
+	{
+		mvcp_notifier_get( notifier, status, atoi( line ) );
+		if ( mvcp_status_parse_delta( status, line ) )
+			return;
+	}
+	else
+	{
+		mvcp_status_parse( status, line );
+	}
+	mvcp_notifier_put( notifier, status );
+}
+
 /** Thread for receiving and distributing the status information.
+
+	Lines are framed in place in the reader's buffer and parsed from there, so
+	nothing is copied or re-scanned between reads.
 */
 
 static void *mvcp_remote_status_thread( void *arg )
 {
 	mvcp_remote remote = arg;
-	char temp[ 10240 ];
-	int length = 0;
-	int offset = 0;
-	mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
+	mvcp_reader reader = mvcp_reader_init( remote->status->fd, 0 );
 	mvcp_notifier notifier = mvcp_parser_get_notifier( remote->parser );
 	mvcp_status_t status;
-	int index = 0;
 
-	mvcp_socket_write_data( remote->status, "STATUS\r\n", 8 );
+	memset( &status, 0, sizeof( status ) );
 
-	while ( !remote->terminated && 
-			( length = mvcp_socket_read_data( remote->status, temp + offset, sizeof( temp ) ) ) >= 0 )
+	/* Servers which don't know about deltas ignore the argument and send full lines */
+	mvcp_socket_write_data( remote->status, "STATUS DELTA\r\n", 14 );
+
+	while ( reader != NULL && !remote->terminated )
 	{
-		if ( strchr( temp, '\n' ) == NULL )
-		{
-			offset = length;
-			continue;
-		}
-		offset = 0;
-		mvcp_tokeniser_parse_new( tokeniser, temp, "\n" );
-		for ( index = 0; index < mvcp_tokeniser_count( tokeniser ); index ++ )
-		{
-			char *line = mvcp_tokeniser_get_string( tokeniser, index );
-			if ( line[ strlen( line ) - 1 ] == '\r' )
-			{
-				mvcp_util_chomp( line );
-				mvcp_status_parse( &status, line );
-				mvcp_notifier_put( notifier, &status );
-			}
-			else
-			{
-				strcpy( temp, line );
-				offset = strlen( temp );
-			}
-		}
+		char *line = NULL;
+		int events = 0;
+
+		while ( ( line = mvcp_reader_next( reader, NULL ) ) != NULL )
+			if ( line[ 0 ] != '\0' )
+				mvcp_remote_status_line( notifier, &status, line );
+
+		if ( reader->eof )
+			break;
+
+		/* The timeout lets us notice termination */
+		events = mvcp_socket_wait( remote->status, POLLIN, remote->status->read_timeout );
+		if ( events < 0 )
+			break;
+		else if ( events > 0 )
+			mvcp_reader_fill( reader );
 	}
 
+	mvcp_reader_close( reader );
 	mvcp_notifier_disconnected( notifier );
-	mvcp_tokeniser_close( tokeniser );
 	remote->terminated = 1;
 
 	return NULL;
 }
 
-/** Forward reference.
+/** Forward references.
 */
 
 static void mvcp_remote_disconnect( mvcp_remote remote );
+static int mvcp_remote_watch( mvcp_remote remote );
 
 /** Connect to the server.
 */
@@ -162,6 +225,8 @@ static mvcp_response mvcp_remote_connect( mvcp_remote remote )
 
 		remote->socket = mvcp_socket_init( remote->server, remote->port );
 		remote->status = mvcp_socket_init( remote->server, remote->port );
+		mvcp_socket_set_timeouts( remote->socket, remote->timeout, MVCP_SOCKET_READ_TIMEOUT, remote->timeout );
+		mvcp_socket_set_timeouts( remote->status, remote->timeout, MVCP_SOCKET_READ_TIMEOUT, remote->timeout );
 
 		if ( mvcp_socket_connect( remote->socket ) == 0 )
 		{
@@ -169,12 +234,20 @@ static mvcp_response mvcp_remote_connect( mvcp_remote remote )
 			mvcp_remote_read_response( remote->socket, response );
 		}
 
-		if ( response != NULL && mvcp_socket_connect( remote->status ) == 0 )
+		if ( response != NULL && remote->silent )
+		{
+			remote->connected = 1;
+		}
+		else if ( response != NULL && remote->multiplexed && mvcp_remote_watch( remote ) == 0 )
+		{
+			remote->connected = 1;
+		}
+		else if ( response != NULL && mvcp_socket_connect( remote->status ) == 0 )
 		{
 			mvcp_response status_response = mvcp_response_init( );
 			mvcp_remote_read_response( remote->status, status_response );
 			if ( mvcp_response_get_error_code( status_response ) == 100 )
-				pthread_create( &remote->thread, NULL, mvcp_remote_status_thread, remote );
+				remote->listening = pthread_create( &remote->thread, NULL, mvcp_remote_status_thread, remote ) == 0;
 			mvcp_response_close( status_response );
 			remote->connected = 1;
 		}
@@ -183,45 +256,587 @@ static mvcp_response mvcp_remote_connect( mvcp_remote remote )
 	return response;
 }
 
-/** Execute the command.
+/** Size of the chunks a body is sent in from a file.
 */
 
-static mvcp_response mvcp_remote_execute( mvcp_remote remote, char *command )
+#define MVCP_REMOTE_CHUNK 16384
+
+/** Write the contents of a file as a chunked body - each chunk is preceded
+	by its size in hex and a zero sized chunk ends the body. Nothing more is
+	written if the file can't be read, so the stream is left incomplete.
+*/
+
+static int mvcp_remote_write_chunks( mvcp_remote remote, FILE *file )
+{
+	char chunk[ MVCP_REMOTE_CHUNK ];
+	char temp[ 20 ];
+	int error = 0;
+	int length = 0;
+
+	rewind( file );
+
+	do
+	{
+		length = fread( chunk, 1, sizeof( chunk ), file );
+		error = length == 0 && ferror( file );
+		if ( !error )
+		{
+			sprintf( temp, "%x\r\n", length );
+			error = mvcp_socket_write_data( remote->socket, temp, strlen( temp ) ) != strlen( temp ) ||
+					mvcp_socket_write_data( remote->socket, chunk, length ) != length;
+		}
+	}
+	while ( !error && length > 0 );
+
+	return error;
+}
+
+/** Write a command and, when given, a body - either a string framed by its
+	size or the contents of a file in chunks. The caller holds the mutex.
+*/
+
+static int mvcp_remote_write( mvcp_remote remote, char *command, char *body, FILE *file )
+{
+	int error = mvcp_socket_write_data( remote->socket, command, strlen( command ) ) != strlen( command );
+	if ( !error )
+		error = mvcp_socket_write_data( remote->socket, "\r\n", 2 ) != 2;
+	if ( !error && body != NULL )
+	{
+		char temp[ 20 ];
+		int length = strlen( body );
+		sprintf( temp, "%d\r\n", length );
+		error = mvcp_socket_write_data( remote->socket, temp, strlen( temp ) ) != strlen( temp ) ||
+				mvcp_socket_write_data( remote->socket, body, length ) != length ||
+				mvcp_socket_write_data( remote->socket, "\r\n", 2 ) != 2;
+	}
+	else if ( !error && file != NULL )
+	{
+		error = mvcp_socket_write_data( remote->socket, "chunked\r\n", 9 ) != 9 ||
+				mvcp_remote_write_chunks( remote, file );
+	}
+	return error;
+}
+
+/** Handle a status line interleaved with the responses ("* " and a status).
+	A line with nothing after the prefix carries no change and is dropped.
+*/
+
+static void mvcp_remote_watched( mvcp_remote remote, char *line )
+{
+	mvcp_status_t status;
+	char *cr = strchr( line, '\r' );
+	if ( cr != NULL )
+		*cr = '\0';
+	if ( line[ 2 ] == '\0' )
+		return;
+	mvcp_remote_status_line( mvcp_parser_get_notifier( remote->parser ), &status, line + 2 );
+}
+
+/** Read one complete response from the pipelined reader, starting with the
+	first line when one has already been read. Returns -1 if the connection
+	ends before the response does.
+*/
+
+static int mvcp_remote_read_framed( mvcp_remote remote, mvcp_response response, char *first )
+{
+	char line[ 10240 ];
+	int eof = 0;
+
+	while ( 1 )
+	{
+		int length = 0;
+		int position;
+		if ( first != NULL )
+		{
+			length = strlen( strcpy( line, first ) );
+			first = NULL;
+		}
+		else
+		{
+			length = mvcp_reader_get_line( remote->reader, line, sizeof( line ) - 1, &eof );
+		}
+		if ( eof && length == 0 )
+			return -1;
+		/* Status lines only ever arrive between responses */
+		if ( remote->watching && mvcp_response_count( response ) == 0 && !strncmp( line, "* ", 2 ) )
+		{
+			mvcp_remote_watched( remote, line );
+			if ( eof )
+				return -1;
+			continue;
+		}
+		line[ length ++ ] = '\n';
+		mvcp_response_write( response, line, length );
+		position = mvcp_response_count( response ) - 1;
+		switch( mvcp_response_get_error_code( response ) )
+		{
+			case 201:
+			case 500:
+				if ( position > 0 && !strcmp( mvcp_response_get_line( response, position ), "" ) )
+					return 0;
+				break;
+			case 202:
+				if ( mvcp_response_count( response ) >= 2 )
+					return 0;
+				break;
+			default:
+				return 0;
+		}
+		if ( eof )
+			return -1;
+	}
+}
+
+/** Mark the connection as failed - everything pending gets a NULL response.
+*/
+
+static void mvcp_remote_fail( mvcp_remote remote )
+{
+	pthread_mutex_lock( &remote->queue_mutex );
+	remote->failed = 1;
+	pthread_mutex_unlock( &remote->queue_mutex );
+}
+
+/** Thread which matches responses to the queue of pending commands and, when
+	watching, passes the interleaved status lines to the notifier.
+
+	Completions are called on this thread, so they must not issue synchronous
+	commands on the same connection.
+*/
+
+static void *mvcp_remote_reader_thread( void *arg )
+{
+	mvcp_remote remote = arg;
+	char line[ 10240 ];
+
+	while ( 1 )
+	{
+		mvcp_remote_request request = NULL;
+		mvcp_response response = NULL;
+		char *first = NULL;
+		int idle = 0;
+
+		pthread_mutex_lock( &remote->queue_mutex );
+		while ( remote->head == NULL && remote->pipelined && !remote->failed && !remote->watching )
+			pthread_cond_wait( &remote->queue_cond, &remote->queue_mutex );
+		request = remote->head;
+		idle = request == NULL && remote->pipelined && !remote->failed;
+		pthread_mutex_unlock( &remote->queue_mutex );
+
+		/* Status arrives while nothing is pending - a response line means a
+		   command was queued since we looked */
+		if ( idle )
+		{
+			int eof = 0;
+			int length = mvcp_reader_get_line( remote->reader, line, sizeof( line ) - 1, &eof );
+			if ( eof && length == 0 )
+			{
+				mvcp_remote_fail( remote );
+				continue;
+			}
+			if ( !strncmp( line, "* ", 2 ) )
+			{
+				mvcp_remote_watched( remote, line );
+				continue;
+			}
+			pthread_mutex_lock( &remote->queue_mutex );
+			request = remote->head;
+			pthread_mutex_unlock( &remote->queue_mutex );
+			if ( request == NULL )
+				continue;
+			first = line;
+		}
+
+		if ( request == NULL )
+			break;
+
+		if ( !remote->failed )
+		{
+			response = mvcp_response_init( );
+			if ( mvcp_remote_read_framed( remote, response, first ) != 0 )
+			{
+				mvcp_response_close( response );
+				response = NULL;
+				mvcp_remote_fail( remote );
+			}
+		}
+
+		pthread_mutex_lock( &remote->queue_mutex );
+		remote->head = request->next;
+		if ( remote->head == NULL )
+			remote->tail = NULL;
+		pthread_cond_broadcast( &remote->queue_cond );
+		pthread_mutex_unlock( &remote->queue_mutex );
+
+		request->completion( request->data, response );
+		free( request );
+	}
+
+	/* Without a status connection, the connection ending is reported here */
+	if ( remote->watching )
+	{
+		mvcp_notifier_disconnected( mvcp_parser_get_notifier( remote->parser ) );
+		remote->terminated = 1;
+	}
+
+	return NULL;
+}
+
+/** Queue a command and write it to the server. The completion is called with
+	the response (or NULL on failure) from the reader thread. Returns non-zero
+	if the command could not be queued, in which case the completion is not
+	called.
+*/
+
+static int mvcp_remote_send( mvcp_remote remote, char *command, char *body, FILE *file, mvcp_completion completion, void *data )
+{
+	mvcp_remote_request request = calloc( 1, sizeof( mvcp_remote_request_t ) );
+	int error = request == NULL;
+
+	if ( !error )
+	{
+		request->completion = completion;
+		request->data = data;
+
+		/* Queue before writing so the reader never sees an unexpected response */
+		pthread_mutex_lock( &remote->mutex );
+		pthread_mutex_lock( &remote->queue_mutex );
+		error = !remote->pipelined || remote->failed;
+		if ( !error )
+		{
+			if ( remote->tail != NULL )
+				remote->tail->next = request;
+			else
+				remote->head = request;
+			remote->tail = request;
+			pthread_cond_broadcast( &remote->queue_cond );
+		}
+		pthread_mutex_unlock( &remote->queue_mutex );
+
+		/* A partial write leaves the stream unusable - the shutdown makes the
+		   reader fail everything which is pending */
+		if ( !error && mvcp_remote_write( remote, command, body, file ) )
+			shutdown( remote->socket->fd, SHUT_RDWR );
+		pthread_mutex_unlock( &remote->mutex );
+
+		if ( error )
+			free( request );
+	}
+
+	return error;
+}
+
+/** Completion used for synchronous commands in pipelined mode.
+*/
+
+static void mvcp_remote_wake( void *data, mvcp_response response )
+{
+	mvcp_remote_wait_t *wait = data;
+	pthread_mutex_lock( &wait->mutex );
+	wait->response = response;
+	wait->done = 1;
+	pthread_cond_signal( &wait->cond );
+	pthread_mutex_unlock( &wait->mutex );
+}
+
+/** Send a command through the pipeline and wait for its response.
+*/
+
+static mvcp_response mvcp_remote_call( mvcp_remote remote, char *command, char *body, FILE *file )
+{
+	mvcp_remote_wait_t wait;
+
+	memset( &wait, 0, sizeof( wait ) );
+	pthread_mutex_init( &wait.mutex, NULL );
+	pthread_cond_init( &wait.cond, NULL );
+
+	if ( mvcp_remote_send( remote, command, body, file, mvcp_remote_wake, &wait ) == 0 )
+	{
+		pthread_mutex_lock( &wait.mutex );
+		while ( !wait.done )
+			pthread_cond_wait( &wait.cond, &wait.mutex );
+		pthread_mutex_unlock( &wait.mutex );
+	}
+
+	pthread_cond_destroy( &wait.cond );
+	pthread_mutex_destroy( &wait.mutex );
+
+	return wait.response;
+}
+
+/** Wait for the reader thread to finish with any responses still pending
+	after pipelined mode was switched off. The caller holds the mutex.
+*/
+
+static void mvcp_remote_drain( mvcp_remote remote )
+{
+	pthread_mutex_lock( &remote->queue_mutex );
+	while ( remote->head != NULL )
+		pthread_cond_wait( &remote->queue_cond, &remote->queue_mutex );
+	pthread_mutex_unlock( &remote->queue_mutex );
+}
+
+/** Send a command with an optional body and wait for the response.
+*/
+
+static mvcp_response mvcp_remote_transfer( mvcp_remote remote, char *command, char *body, FILE *file )
 {
 	mvcp_response response = NULL;
+	if ( remote->pipelined )
+		return mvcp_remote_call( remote, command, body, file );
 	pthread_mutex_lock( &remote->mutex );
-	if ( mvcp_socket_write_data( remote->socket, command, strlen( command ) ) == strlen( command ) )
+	mvcp_remote_drain( remote );
+	if ( mvcp_remote_write( remote, command, body, file ) == 0 )
 	{
 		response = mvcp_response_init( );
-		mvcp_socket_write_data( remote->socket, "\r\n", 2 );
 		mvcp_remote_read_response( remote->socket, response );
 	}
+	else if ( file != NULL )
+	{
+		/* The server is left waiting for the rest of the body */
+		shutdown( remote->socket->fd, SHUT_RDWR );
+	}
 	pthread_mutex_unlock( &remote->mutex );
 	return response;
 }
 
+/** Execute the command.
+*/
+
+static mvcp_response mvcp_remote_execute( mvcp_remote remote, char *command )
+{
+	return mvcp_remote_transfer( remote, command, NULL, NULL );
+}
+
 /** Push a MLT XML document to the server.
 */
 
 static mvcp_response mvcp_remote_receive( mvcp_remote remote, char *command, char *buffer )
 {
-	mvcp_response response = NULL;
+	return mvcp_remote_transfer( remote, command, buffer, NULL );
+}
+
+/** Submit a command without waiting for the response. Outside of pipelined
+	mode the command is executed synchronously.
+*/
+
+static int mvcp_remote_submit( mvcp_remote remote, char *command, mvcp_completion completion, void *data )
+{
+	if ( remote->pipelined )
+		return mvcp_remote_send( remote, command, NULL, NULL, completion, data );
+	completion( data, mvcp_remote_execute( remote, command ) );
+	return 0;
+}
+
+/** Stop the reader thread. Pending commands are failed or, when fail is 0,
+	left to complete first. The mutex must not be held since completions may
+	submit further commands.
+*/
+
+static void mvcp_remote_stop_pipeline( mvcp_remote remote, int fail )
+{
+	pthread_mutex_lock( &remote->queue_mutex );
+	remote->pipelined = 0;
+	if ( fail )
+		remote->failed = 1;
+	pthread_cond_broadcast( &remote->queue_cond );
+	pthread_mutex_unlock( &remote->queue_mutex );
+	if ( fail )
+		shutdown( remote->socket->fd, SHUT_RDWR );
+	pthread_join( remote->reader_thread, NULL );
 	pthread_mutex_lock( &remote->mutex );
-	if ( mvcp_socket_write_data( remote->socket, command, strlen( command ) ) == strlen( command ) )
+	mvcp_reader_close( remote->reader );
+	remote->reader = NULL;
+	pthread_mutex_unlock( &remote->mutex );
+}
+
+/** Set the milliseconds a connect or a command write may stall before it
+	fails (-1, the default, waits indefinitely). Takes effect on connect.
+*/
+
+void mvcp_remote_set_timeout( mvcp_parser parser, int timeout )
+{
+	if ( parser != NULL && parser->submit == (parser_submit)mvcp_remote_submit )
+		( ( mvcp_remote )parser->real )->timeout = timeout;
+}
+
+/** Start the reader thread. The caller holds the mutex.
+*/
+
+static int mvcp_remote_start_pipeline( mvcp_remote remote )
+{
+	int error = remote->reader != NULL || ( remote->reader = mvcp_reader_init( remote->socket->fd, 0 ) ) == NULL;
+	if ( !error )
 	{
-		char temp[ 20 ];
-		int length = strlen( buffer );
-		response = mvcp_response_init( );
-		mvcp_socket_write_data( remote->socket, "\r\n", 2 );
-		sprintf( temp, "%d", length );
-		mvcp_socket_write_data( remote->socket, temp, strlen( temp ) );
-		mvcp_socket_write_data( remote->socket, "\r\n", 2 );
-		mvcp_socket_write_data( remote->socket, buffer, length );
-		mvcp_socket_write_data( remote->socket, "\r\n", 2 );
-		mvcp_remote_read_response( remote->socket, response );
+		remote->failed = 0;
+		remote->pipelined = 1;
+		if ( pthread_create( &remote->reader_thread, NULL, mvcp_remote_reader_thread, remote ) != 0 )
+		{
+			remote->pipelined = 0;
+			mvcp_reader_close( remote->reader );
+			remote->reader = NULL;
+			error = 1;
+		}
+	}
+	return error;
+}
+
+/** Completion for the WATCH sent on connect - a server which doesn't know
+	it leaves us waiting for commands again before the caller is woken.
+*/
+
+static void mvcp_remote_watch_done( void *data, mvcp_response response )
+{
+	mvcp_remote_wait_t *wait = data;
+	if ( mvcp_response_get_error_code( response ) != 200 )
+	{
+		pthread_mutex_lock( &wait->remote->queue_mutex );
+		wait->remote->watching = 0;
+		pthread_mutex_unlock( &wait->remote->queue_mutex );
 	}
+	mvcp_remote_wake( data, response );
+}
+
+/** Ask the server to interleave status with the responses on the command
+	connection. Returns non-zero if it can't, leaving the connection as it was.
+*/
+
+static int mvcp_remote_watch( mvcp_remote remote )
+{
+	mvcp_remote_wait_t wait;
+	int error = 0;
+
+	memset( &wait, 0, sizeof( wait ) );
+	pthread_mutex_init( &wait.mutex, NULL );
+	pthread_cond_init( &wait.cond, NULL );
+	wait.remote = remote;
+
+	pthread_mutex_lock( &remote->mutex );
+	remote->watching = 1;
+	error = mvcp_remote_start_pipeline( remote );
 	pthread_mutex_unlock( &remote->mutex );
-	return response;
+
+	if ( !error && mvcp_remote_send( remote, "WATCH DELTA", NULL, NULL, mvcp_remote_watch_done, &wait ) == 0 )
+	{
+		pthread_mutex_lock( &wait.mutex );
+		while ( !wait.done )
+			pthread_cond_wait( &wait.cond, &wait.mutex );
+		pthread_mutex_unlock( &wait.mutex );
+	}
+
+	error = error || mvcp_response_get_error_code( wait.response ) != 200;
+	mvcp_response_close( wait.response );
+	pthread_cond_destroy( &wait.cond );
+	pthread_mutex_destroy( &wait.mutex );
+
+	if ( error )
+	{
+		remote->watching = 0;
+		if ( remote->pipelined )
+			mvcp_remote_stop_pipeline( remote, 0 );
+	}
+
+	return error;
+}
+
+/** Use a single connection for commands and status (see WATCH in the
+	protocol) rather than a second connection and thread for the status.
+	Takes effect on connect and falls back to the status connection for
+	servers without WATCH. The connection is always pipelined when on.
+*/
+
+void mvcp_remote_set_multiplexed( mvcp_parser parser, int multiplexed )
+{
+	if ( parser != NULL && parser->submit == (parser_submit)mvcp_remote_submit )
+		( ( mvcp_remote )parser->real )->multiplexed = multiplexed;
+}
+
+/** Don't follow the unit status at all - no status connection, thread or
+	WATCH is set up, so only the command connection is made. For clients
+	which only send commands. Takes effect on connect.
+*/
+
+void mvcp_remote_set_silent( mvcp_parser parser, int silent )
+{
+	if ( parser != NULL && parser->submit == (parser_submit)mvcp_remote_submit )
+		( ( mvcp_remote )parser->real )->silent = silent;
+}
+
+/** Send pushed services as a chunked body streamed from a temporary file
+	rather than building the document in memory (see PUSH in the protocol).
+	Needs a server which accepts chunked bodies.
+*/
+
+void mvcp_remote_set_chunked( mvcp_parser parser, int chunked )
+{
+	if ( parser != NULL && parser->submit == (parser_submit)mvcp_remote_submit )
+		( ( mvcp_remote )parser->real )->chunked = chunked;
+}
+
+/** Check that a connected remote parser is still usable, such as one which
+	has been kept idle for reuse. Nothing is due from the server on an idle
+	command connection, so anything to read (normally the server closing
+	it) means it can't be used. Returns non-zero if it can't.
+*/
+
+int mvcp_remote_check( mvcp_parser parser )
+{
+	mvcp_remote remote = parser != NULL && parser->submit == (parser_submit)mvcp_remote_submit ? parser->real : NULL;
+	int error = remote == NULL;
+
+	if ( !error )
+	{
+		pthread_mutex_lock( &remote->mutex );
+		if ( !remote->connected || remote->terminated )
+		{
+			error = 1;
+		}
+		else if ( remote->pipelined )
+		{
+			pthread_mutex_lock( &remote->queue_mutex );
+			error = remote->failed;
+			pthread_mutex_unlock( &remote->queue_mutex );
+		}
+		else
+		{
+			error = mvcp_socket_wait( remote->socket, POLLIN, 0 ) != 0;
+		}
+		pthread_mutex_unlock( &remote->mutex );
+	}
+
+	return error;
+}
+
+/** Switch pipelined mode on or off for a connected remote parser.
+
+	When on, commands may be written while earlier responses are still
+	outstanding and mvcp_parser_submit returns without waiting. Switching off
+	waits for the pending responses and has no effect on a multiplexed
+	connection. Returns non-zero on error.
+*/
+
+int mvcp_remote_set_pipelined( mvcp_parser parser, int pipelined )
+{
+	mvcp_remote remote = parser != NULL && parser->submit == (parser_submit)mvcp_remote_submit ? parser->real : NULL;
+	int error = remote == NULL;
+
+	if ( !error )
+	{
+		pthread_mutex_lock( &remote->mutex );
+		if ( pipelined && !remote->pipelined )
+		{
+			error = !remote->connected || mvcp_remote_start_pipeline( remote );
+		}
+		else if ( !pipelined && remote->pipelined && !remote->watching )
+		{
+			pthread_mutex_unlock( &remote->mutex );
+			mvcp_remote_stop_pipeline( remote, 0 );
+			return error;
+		}
+		pthread_mutex_unlock( &remote->mutex );
+	}
+
+	return error;
 }
 
 /** Push a producer to the server.
@@ -231,7 +846,38 @@ static mvcp_response mvcp_remote_push( mvcp_remote remote, char *command, mlt_se
 {
 	mvcp_response response = NULL;
 #ifndef MVCP_EMBEDDED
-	if ( service != NULL )
+	if ( service != NULL && remote->chunked )
+	{
+		const char *dir = getenv( "TMPDIR" );
+		char path[ 512 ];
+		int fd = -1;
+
+		snprintf( path, sizeof( path ), "%s/mvcp-push.XXXXXX", dir != NULL && *dir != '\0' ? dir : "/tmp" );
+		fd = mkstemp( path );
+		if ( fd >= 0 )
+		{
+			mlt_consumer consumer = mlt_factory_consumer( NULL, "xml", path );
+			mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+			FILE *file = NULL;
+			// Temporary hack
+			mlt_properties_set( properties, "store", "nle_" );
+			mlt_consumer_connect( consumer, service );
+			mlt_consumer_start( consumer );
+			file = fdopen( fd, "r" );
+			if ( file != NULL )
+			{
+				response = mvcp_remote_transfer( remote, command, NULL, file );
+				fclose( file );
+			}
+			else
+			{
+				close( fd );
+			}
+			mlt_consumer_close( consumer );
+			unlink( path );
+		}
+	}
+	else if ( service != NULL )
 	{
 		mlt_consumer consumer = mlt_factory_consumer( NULL, "xml", "buffer" );
 		mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
@@ -255,12 +901,16 @@ static void mvcp_remote_disconnect( mvcp_remote remote )
 {
 	if ( remote != NULL && remote->terminated )
 	{
-		if ( remote->connected )
+		if ( remote->pipelined )
+			mvcp_remote_stop_pipeline( remote, 1 );
+		if ( remote->listening )
 			pthread_join( remote->thread, NULL );
 		mvcp_socket_close( remote->status );
 		mvcp_socket_close( remote->socket );
 		remote->connected = 0;
 		remote->terminated = 0;
+		remote->watching = 0;
+		remote->listening = 0;
 	}
 }
 
@@ -274,6 +924,8 @@ static void mvcp_remote_close( mvcp_remote remote )
 		remote->terminated = 1;
 		mvcp_remote_disconnect( remote );
 		pthread_mutex_destroy( &remote->mutex );
+		pthread_mutex_destroy( &remote->queue_mutex );
+		pthread_cond_destroy( &remote->queue_cond );
 		free( remote->server );
 		free( remote );
 	}
@@ -291,6 +943,8 @@ static int mvcp_remote_read_response( mvcp_socket socket, mvcp_response response
 	while ( !terminated && ( length = mvcp_socket_read_data( socket, temp, 10240 ) ) >= 0 )
 	{
 		int position = 0;
+		if ( length == 0 )
+			continue;
 		temp[ length ] = '\0';
 		mvcp_response_write( response, temp, length );
 		position = mvcp_response_count( response ) - 1;
@@ -33,6 +33,12 @@ extern "C"
 */
 
 extern mvcp_parser mvcp_parser_init_remote( char *, int );
+extern int mvcp_remote_set_pipelined( mvcp_parser, int );
+extern void mvcp_remote_set_timeout( mvcp_parser, int );
+extern void mvcp_remote_set_multiplexed( mvcp_parser, int );
+extern void mvcp_remote_set_silent( mvcp_parser, int );
+extern void mvcp_remote_set_chunked( mvcp_parser, int );
+extern int mvcp_remote_check( mvcp_parser );
 
 #ifdef __cplusplus
 }
@@ -27,6 +27,13 @@
 /* Application header files */
 #include "mvcp_response.h"
 
+/** Size of the first block of text storage - subsequent blocks double up to
+	the maximum.
+*/
+
+#define MVCP_RESPONSE_CHUNK 2048
+#define MVCP_RESPONSE_CHUNK_MAX 65536
+
 /** Construct a new MVCP response.
 */
 
@@ -38,6 +45,46 @@ mvcp_response mvcp_response_init( )
 	return response;
 }
 
+/** Obtain storage for a line of needed bytes (including the NUL). When line is
+	given, its current length bytes are preserved - in place if the line is
+	the last thing stored and there's room to extend it, otherwise by copying.
+	Lines which have been completed are never moved.
+*/
+
+static char *mvcp_response_reserve( mvcp_response response, char *line, int length, int needed )
+{
+	mvcp_response_chunk chunk = response->chunks;
+	char *result = NULL;
+
+	if ( line != NULL && chunk != NULL && line + length + 1 == chunk->data + chunk->used && line - chunk->data + needed <= chunk->size )
+	{
+		chunk->used = line - chunk->data + needed;
+		return line;
+	}
+
+	if ( chunk == NULL || chunk->used + needed > chunk->size )
+	{
+		int size = chunk == NULL ? MVCP_RESPONSE_CHUNK : chunk->size * 2;
+		if ( size > MVCP_RESPONSE_CHUNK_MAX )
+			size = MVCP_RESPONSE_CHUNK_MAX;
+		if ( size < needed )
+			size = needed;
+		chunk = malloc( sizeof( struct mvcp_response_chunk_s ) + size );
+		if ( chunk == NULL )
+			return NULL;
+		chunk->next = response->chunks;
+		chunk->size = size;
+		chunk->used = 0;
+		response->chunks = chunk;
+	}
+
+	result = chunk->data + chunk->used;
+	chunk->used += needed;
+	if ( line != NULL )
+		memcpy( result, line, length );
+	return result;
+}
+
 /** Clone a MVCP response
 */
 
@@ -49,8 +96,8 @@ mvcp_response mvcp_response_clone( mvcp_response response )
 		int index = 0;
 		for ( index = 0; index < mvcp_response_count( response ); index ++ )
 		{
-			char *line = mvcp_response_get_line( response, index );
-			mvcp_response_printf( clone, strlen( line ) + 2, "%s\n", line );
+			mvcp_response_write( clone, mvcp_response_get_line( response, index ), mvcp_response_get_length( response, index ) );
+			mvcp_response_write( clone, "\n", 1 );
 		}
 	}
 	return clone;
@@ -105,6 +152,17 @@ char *mvcp_response_get_line( mvcp_response response, int index )
 		return NULL;
 }
 
+/** Get the length of the line at the given index without scanning it.
+*/
+
+int mvcp_response_get_length( mvcp_response response, int index )
+{
+	if ( index < response->count )
+		return response->lengths[ index ];
+	else
+		return 0;
+}
+
 /** Return the number of lines of text in the response.
 */
 
@@ -128,29 +186,54 @@ void mvcp_response_set_error( mvcp_response response, int error_code, const char
 	else
 	{
 		char temp[ 10240 ];
-		int length = sprintf( temp, "%d %s", error_code, error_string );
-		response->array[ 0 ] = realloc( response->array[ 0 ], length + 1 );
-		strcpy( response->array[ 0 ], temp );
+		int length = snprintf( temp, sizeof( temp ), "%d %s", error_code, error_string );
+		if ( length >= sizeof( temp ) )
+			length = sizeof( temp ) - 1;
+		if ( length > response->lengths[ 0 ] )
+		{
+			char *line = mvcp_response_reserve( response, NULL, 0, length + 1 );
+			if ( line == NULL )
+				return;
+			response->array[ 0 ] = line;
+		}
+		memcpy( response->array[ 0 ], temp, length + 1 );
+		response->lengths[ 0 ] = length;
 	}
 }
 
-/** Write formatted text to the response. 
+/** Write formatted text to the response. Size is the most text that will be
+	written - short text is formatted on the stack.
 */
 
 int mvcp_response_printf( mvcp_response response, size_t size, const char *format, ... )
 {
+	char buffer[ 1024 ];
+	char *text = buffer;
 	int length = 0;
-	char *text = malloc( size );
-	if ( text != NULL )
+	va_list list;
+
+	va_start( list, format );
+	length = vsnprintf( buffer, size < sizeof( buffer ) ? size : sizeof( buffer ), format, list );
+	va_end( list );
+
+	if ( length >= sizeof( buffer ) && size > sizeof( buffer ) )
 	{
-		va_list list;
+		text = malloc( size );
+		if ( text == NULL )
+			return 0;
 		va_start( list, format );
 		length = vsnprintf( text, size, format, list );
-		if ( length != 0 )
-			mvcp_response_write( response, text, length );
 		va_end( list );
-		free( text );
 	}
+
+	if ( length >= size )
+		length = size - 1;
+	if ( length > 0 )
+		mvcp_response_write( response, text, length );
+
+	if ( text != buffer )
+		free( text );
+
 	return length;
 }
 
@@ -165,63 +248,63 @@ int mvcp_response_write( mvcp_response response, const char *text, int size )
 	while ( size > 0 )
 	{
 		int index = response->count - 1;
-		const char *lf = strchr( ptr, '\n' );
-		int length_of_string = 0;
-
-		/* Make sure we have space in the dynamic array. */
-		if ( !response->append && response->count >= response->size - 1 )
-		{
-			response->size += 50;
-			response->array = realloc( response->array, response->size * sizeof( char * ) );
-		}
+		const char *lf = memchr( ptr, '\n', size );
+		int chars = lf != NULL ? lf - ptr : size;
+		int length = 0;
+		char *line = NULL;
 
-		/* Make sure the array is valid, or we're really in trouble */
-		if ( response->array == NULL )
+		/* Make sure we have space in the line index. */
+		if ( !response->append && response->count >= response->size )
 		{
-			ret = 0;
-			break;
+			int capacity = response->size == 0 ? 16 : response->size * 2;
+			char **array = realloc( response->array, capacity * sizeof( char * ) );
+			int *lengths = array != NULL ? realloc( response->lengths, capacity * sizeof( int ) ) : NULL;
+			if ( array != NULL )
+				response->array = array;
+			if ( lengths == NULL )
+				break;
+			response->lengths = lengths;
+			response->size = capacity;
 		}
 
-		/* Now, if we're appending to the previous write (ie: if it wasn't
-		   terminated by a LF), then use the index calculated above, otherwise
-		   go to the next one and ensure it's NULLed. */
-
-		if ( !response->append )
+		/* Either extend the line from the previous unterminated write or start a new one */
+		if ( response->append )
 		{
-			response->array[ ++ index ] = NULL;
-			response->count ++;
+			line = response->array[ index ];
+			length = response->lengths[ index ];
 		}
 		else
 		{
-			length_of_string = strlen( response->array[ index ] );
+			index ++;
 		}
 
-		/* Now we need to know how to handle the current ptr with respect to lf. */
-		/* TODO: tidy up and error check... sigh... tested for many, many 1000s of lines */
+		line = mvcp_response_reserve( response, line, length, length + chars + 1 );
+		if ( line == NULL )
+			break;
+
+		memcpy( line + length, ptr, chars );
+		length += chars;
+		line[ length ] = '\0';
+		if ( length > 0 && line[ length - 1 ] == '\r' )
+			line[ -- length ] = '\0';
+
+		response->array[ index ] = line;
+		response->lengths[ index ] = length;
+		if ( !response->append )
+			response->count ++;
 
 		if ( lf == NULL )
 		{
-			response->array[ index ] = realloc( response->array[ index ], length_of_string + size + 1 );
-			memcpy( response->array[ index ] + length_of_string, ptr, size );
-			response->array[ index ][ length_of_string + size ] = '\0';
-			if ( ( length_of_string + size ) > 0 && response->array[ index ][ length_of_string + size - 1 ] == '\r' )
-				response->array[ index ][ length_of_string + size - 1 ] = '\0';
+			ret += chars;
 			size = 0;
-			ret += size;
 			response->append = 1;
 		}
 		else
 		{
-			int chars = lf - ptr;
-			response->array[ index ] = realloc( response->array[ index ], length_of_string + chars + 1 );
-			memcpy( response->array[ index ] + length_of_string, ptr, chars );
-			response->array[ index ][ length_of_string + chars ] = '\0';
-			if ( ( length_of_string + chars ) > 0 && response->array[ index ][ length_of_string + chars - 1 ] == '\r' )
-				response->array[ index ][ length_of_string + chars - 1 ] = '\0';
-			ptr = ptr + chars + 1;
-			size -= ( chars + 1 );
-			response->append = 0;
+			ptr = lf + 1;
+			size -= chars + 1;
 			ret += chars + 1;
+			response->append = 0;
 		}
 	}
 
@@ -235,10 +318,14 @@ void mvcp_response_close( mvcp_response response )
 {
 	if ( response != NULL )
 	{
-		int index = 0;
-		for ( index = 0; index < response->count; index ++ )
-			free( response->array[ index ] );
+		while ( response->chunks != NULL )
+		{
+			mvcp_response_chunk next = response->chunks->next;
+			free( response->chunks );
+			response->chunks = next;
+		}
 		free( response->array );
+		free( response->lengths );
 		free( response );
 	}
 }
@@ -28,15 +28,29 @@ extern "C"
 {
 #endif
 
+/** Block of storage holding the text of a response.
+*/
+
+typedef struct mvcp_response_chunk_s
+{
+	struct mvcp_response_chunk_s *next;
+	int size;
+	int used;
+	char data[ 1 ];
+}
+*mvcp_response_chunk;
+
 /** Structure for the response
 */
 
 typedef struct
 {
 	char **array;
+	int *lengths;
 	int size;
 	int count;
 	int append;
+	mvcp_response_chunk chunks;
 }
 *mvcp_response, mvcp_response_t;
 
@@ -48,6 +62,7 @@ extern mvcp_response mvcp_response_clone( mvcp_response );
 extern int mvcp_response_get_error_code( mvcp_response );
 extern const char *mvcp_response_get_error_string( mvcp_response );
 extern char *mvcp_response_get_line( mvcp_response, int );
+extern int mvcp_response_get_length( mvcp_response, int );
 extern int mvcp_response_count( mvcp_response );
 extern void mvcp_response_set_error( mvcp_response, int, const char * );
 extern int mvcp_response_printf( mvcp_response, size_t, const char *, ... );
@@ -32,8 +32,8 @@
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #include <netinet/in.h>
-#include <sys/time.h>
 
 /* Application header files */
 #include "mvcp_socket.h"
@@ -50,38 +50,84 @@ mvcp_socket mvcp_socket_init( char *server, int port )
 		socket->fd = -1;
 		socket->server = strdup( server );
 		socket->port = port;
+		socket->connect_timeout = -1;
+		socket->read_timeout = MVCP_SOCKET_READ_TIMEOUT;
+		socket->write_timeout = -1;
 	}
 	return socket;
 }
 
+/** Set the timeouts in milliseconds (-1 waits indefinitely). The read timeout
+	is the longest mvcp_socket_read_data waits before returning 0, the others
+	are the longest a connect or write may stall before it fails.
+*/
+
+void mvcp_socket_set_timeouts( mvcp_socket socket, int connect, int read, int write )
+{
+	socket->connect_timeout = connect;
+	socket->read_timeout = read;
+	socket->write_timeout = write;
+}
+
+/** Wait for the events (POLLIN, POLLOUT) on the socket. Returns the events
+	which occurred, 0 on timeout and -1 on error.
+*/
+
+int mvcp_socket_wait( mvcp_socket socket, int events, int timeout )
+{
+	struct pollfd pfd;
+	int result = 0;
+
+	pfd.fd = socket->fd;
+	pfd.events = events;
+	pfd.revents = 0;
+
+	do
+		result = poll( &pfd, 1, timeout );
+	while ( result < 0 && errno == EINTR );
+
+	return result > 0 ? pfd.revents : result;
+}
+
 /** Connect to the server.
 */
 
 int mvcp_socket_connect( mvcp_socket connection )
 {
-	int ret = 0;
-    struct hostent *host;
-    struct sockaddr_in sock;
+	int ret = -1;
+	struct hostent *host;
+	struct sockaddr_in sock;
 
-	if ( connection->server != NULL )
+	if ( connection->server != NULL && ( host = gethostbyname( connection->server ) ) != NULL )
 	{		
-		host = gethostbyname( connection->server );
-	
 		memset( &sock, 0, sizeof( struct sockaddr_in ) );
 		memcpy( &sock.sin_addr, host->h_addr, host->h_length );
 		sock.sin_family = host->h_addrtype;
 		sock.sin_port = htons( connection->port );
 	
 		if ( ( connection->fd = socket( AF_INET, SOCK_STREAM, 0 ) ) != -1 )
+		{
+			connection->flags = fcntl( connection->fd, F_GETFL );
+			fcntl( connection->fd, F_SETFL, connection->flags | O_NONBLOCK );
 			ret = connect( connection->fd, (const struct sockaddr *)&sock, sizeof( struct sockaddr_in ) );
-		else
-			ret = -1;
+			if ( ret != 0 && errno == EINPROGRESS )
+			{
+				int error = 0;
+				socklen_t length = sizeof( error );
+				if ( mvcp_socket_wait( connection, POLLOUT, connection->connect_timeout ) > 0 &&
+					 getsockopt( connection->fd, SOL_SOCKET, SO_ERROR, &error, &length ) == 0 && error == 0 )
+					ret = 0;
+				else
+					errno = error != 0 ? error : ETIMEDOUT;
+			}
+		}
 	}
 	
 	return ret;	
 }
 
-/** Convenience constructor for a connected file descriptor.
+/** Convenience constructor for a connected file descriptor. The descriptor is
+	made non-blocking while the socket owns it.
 */
 
 mvcp_socket mvcp_socket_init_fd( int fd )
@@ -92,77 +138,170 @@ mvcp_socket mvcp_socket_init_fd( int fd )
 		memset( socket, 0, sizeof( mvcp_socket_t ) );
 		socket->fd = fd;
 		socket->no_close = 1;
+		socket->flags = fcntl( fd, F_GETFL );
+		socket->connect_timeout = -1;
+		socket->read_timeout = MVCP_SOCKET_READ_TIMEOUT;
+		socket->write_timeout = -1;
+		fcntl( fd, F_SETFL, socket->flags | O_NONBLOCK );
 	}
 	return socket;
 }
 
-/** Read an arbitrarily formatted block of data from the server.
+/** Read an arbitrarily formatted block of data from the server. Returns the
+	number of bytes read, 0 if nothing arrived within the read timeout and -1
+	at end of file or on error.
 */
 
 int mvcp_socket_read_data( mvcp_socket socket, char *data, int length )
 {
-    struct timeval tv = { 1, 0 };
-    fd_set rfds;
 	int used = 0;
+	int events = mvcp_socket_wait( socket, POLLIN, socket->read_timeout );
 
 	data[ 0 ] = '\0';
 
-    FD_ZERO( &rfds );
-    FD_SET( socket->fd, &rfds );
-
-	if ( select( socket->fd + 1, &rfds, NULL, NULL, &tv ) )
+	if ( events < 0 )
 	{
-		used = read( socket->fd, data, length - 1 );
+		used = -1;
+	}
+	else if ( events > 0 )
+	{
+		do
+			used = read( socket->fd, data, length - 1 );
+		while ( used < 0 && errno == EINTR );
 		if ( used > 0 )
 			data[ used ] = '\0';
-		else
+		else if ( used == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) )
 			used = -1;
+		else
+			used = 0;
 	}
 
 	return used;
 }	
 
-/** Write an arbitrarily formatted block of data to the server.
+/** Write as much of the pending data as the socket accepts without blocking.
+	Returns the number of bytes still pending or -1 on error.
+*/
+
+int mvcp_socket_flush( mvcp_socket socket )
+{
+	while ( socket->pending > 0 )
+	{
+		int inc = write( socket->fd, socket->buffer + socket->sent, socket->pending );
+		if ( inc > 0 )
+		{
+			socket->sent += inc;
+			socket->pending -= inc;
+		}
+		else if ( inc < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		else if ( inc < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+		{
+			break;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	if ( socket->pending == 0 )
+		socket->sent = 0;
+	return socket->pending;
+}
+
+/** Number of bytes queued by mvcp_socket_send which are still to be written.
+*/
+
+int mvcp_socket_pending( mvcp_socket socket )
+{
+	return socket->pending;
+}
+
+/** Queue data behind anything already pending and write what the socket
+	accepts without blocking - the rest is left for mvcp_socket_flush. Returns
+	the number of bytes still pending or -1 on error (including more than
+	MVCP_SOCKET_PENDING_MAX bytes backing up).
+*/
+
+int mvcp_socket_send( mvcp_socket socket, const char *data, int length )
+{
+	if ( socket->pending + length > MVCP_SOCKET_PENDING_MAX )
+		return -1;
+
+	if ( socket->sent + socket->pending + length > socket->size )
+	{
+		if ( socket->sent > 0 )
+		{
+			memmove( socket->buffer, socket->buffer + socket->sent, socket->pending );
+			socket->sent = 0;
+		}
+		if ( socket->pending + length > socket->size )
+		{
+			int size = socket->size == 0 ? 4096 : socket->size;
+			char *buffer = NULL;
+			while ( size < socket->pending + length )
+				size *= 2;
+			buffer = realloc( socket->buffer, size );
+			if ( buffer == NULL )
+				return -1;
+			socket->buffer = buffer;
+			socket->size = size;
+		}
+	}
+
+	memcpy( socket->buffer + socket->sent + socket->pending, data, length );
+	socket->pending += length;
+
+	return mvcp_socket_flush( socket );
+}
+
+/** Write an arbitrarily formatted block of data to the server, waiting up to
+	the write timeout each time the socket stops accepting data. Anything left
+	pending by mvcp_socket_send goes first, but the data itself is written
+	directly rather than queued, so its size isn't limited. Returns length or
+	-1 on error.
 */
 
 int mvcp_socket_write_data( mvcp_socket socket, const char *data, int length )
 {
-	int used = 0;
-	
-	while ( used >=0 && used < length )
+	int pending = mvcp_socket_flush( socket );
+	int written = 0;
+
+	while ( pending > 0 )
 	{
-		struct timeval tv = { 1, 0 };
-		fd_set rfds;
-		fd_set wfds;
-		fd_set efds;
-	
-		FD_ZERO( &rfds );
-		FD_SET( socket->fd, &rfds );
-		FD_ZERO( &wfds );
-		FD_SET( socket->fd, &wfds );
-		FD_ZERO( &efds );
-		FD_SET( socket->fd, &efds );
-	
-		errno = 0;
+		int events = mvcp_socket_wait( socket, POLLOUT, socket->write_timeout );
+		if ( events <= 0 || ( events & ( POLLERR | POLLHUP | POLLNVAL ) ) )
+			pending = -1;
+		else
+			pending = mvcp_socket_flush( socket );
+	}
 
-		if ( select( socket->fd + 1, &rfds, &wfds, &efds, &tv ) )
+	while ( pending == 0 && written < length )
+	{
+		int inc = write( socket->fd, data + written, length - written );
+		if ( inc > 0 )
 		{
-			if ( errno != 0 || FD_ISSET( socket->fd, &efds ) || FD_ISSET( socket->fd, &rfds ) )
-			{
-				used = -1;
-			}
-			else if ( FD_ISSET( socket->fd, &wfds ) )
-			{
-				int inc = write( socket->fd, data + used, length - used );
-				if ( inc > 0 )
-					used += inc;
-				else
-					used = -1;
-			}
+			written += inc;
+		}
+		else if ( inc < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		else if ( inc < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+		{
+			int events = mvcp_socket_wait( socket, POLLOUT, socket->write_timeout );
+			if ( events <= 0 || ( events & ( POLLERR | POLLHUP | POLLNVAL ) ) )
+				pending = -1;
+		}
+		else
+		{
+			pending = -1;
 		}
 	}
 
-	return used;
+	return pending == 0 ? length : -1;
 }
 
 /** Close the socket.
@@ -170,8 +309,11 @@ int mvcp_socket_write_data( mvcp_socket socket, const char *data, int length )
 
 void mvcp_socket_close( mvcp_socket socket )
 {
-	if ( socket->fd > 0 && !socket->no_close )
+	if ( socket->fd >= 0 && socket->no_close )
+		fcntl( socket->fd, F_SETFL, socket->flags );
+	else if ( socket->fd >= 0 )
 		close( socket->fd );
+	free( socket->buffer );
 	free( socket->server );
 	free( socket );
 }
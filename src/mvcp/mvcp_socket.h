@@ -27,6 +27,16 @@ extern "C"
 {
 #endif
 
+/** Default read timeout in milliseconds.
+*/
+
+#define MVCP_SOCKET_READ_TIMEOUT 1000
+
+/** Largest amount of unsent data mvcp_socket_send will queue.
+*/
+
+#define MVCP_SOCKET_PENDING_MAX 1048576
+
 /** Structure for socket.
 */
 
@@ -36,6 +46,14 @@ typedef struct
 	int port;
 	int fd;
 	int no_close;
+	int flags;
+	int connect_timeout;
+	int read_timeout;
+	int write_timeout;
+	char *buffer;
+	int size;
+	int sent;
+	int pending;
 }
 *mvcp_socket, mvcp_socket_t;
 
@@ -45,8 +63,13 @@ typedef struct
 extern mvcp_socket mvcp_socket_init( char *, int );
 extern int mvcp_socket_connect( mvcp_socket );
 extern mvcp_socket mvcp_socket_init_fd( int );
+extern void mvcp_socket_set_timeouts( mvcp_socket, int, int, int );
+extern int mvcp_socket_wait( mvcp_socket, int, int );
 extern int mvcp_socket_read_data( mvcp_socket, char *, int );
 extern int mvcp_socket_write_data( mvcp_socket, const char *, int );
+extern int mvcp_socket_send( mvcp_socket, const char *, int );
+extern int mvcp_socket_flush( mvcp_socket );
+extern int mvcp_socket_pending( mvcp_socket );
 extern void mvcp_socket_close( mvcp_socket );
 
 #ifdef __cplusplus
@@ -22,61 +22,263 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 /* Application header files */
 #include "mvcp_status.h"
-#include "mvcp_tokeniser.h"
-#include "mvcp_util.h"
+#include "mvcp_title.h"
 
-/** Parse a unit status string.
+/** Status words indexed by their codes.
+*/
+
+static const struct
+{
+	const char *word;
+	int length;
+}
+mvcp_status_words[ ] =
+{
+	{ "unknown", 7 },
+	{ "undefined", 9 },
+	{ "offline", 7 },
+	{ "not_loaded", 10 },
+	{ "stopped", 7 },
+	{ "playing", 7 },
+	{ "paused", 6 },
+	{ "disconnected", 12 }
+};
+
+#define MVCP_STATUS_WORDS ( int )( sizeof( mvcp_status_words ) / sizeof( mvcp_status_words[ 0 ] ) )
+
+/** Map a status word to its code - the word need not be NUL terminated and
+	the code is left alone if the word isn't recognised. No two words share
+	both their length and first character, so at most one word is compared.
+*/
+
+static void mvcp_status_code( const char *word, int length, unit_status *status )
+{
+	int index;
+
+	for ( index = 0; index < MVCP_STATUS_WORDS; index ++ )
+	{
+		if ( mvcp_status_words[ index ].length == length && mvcp_status_words[ index ].word[ 0 ] == word[ 0 ] )
+		{
+			if ( !memcmp( mvcp_status_words[ index ].word, word, length ) )
+				*status = ( unit_status )index;
+			break;
+		}
+	}
+}
+
+/** Get the word used for a status code - codes out of range are unknown.
+*/
+
+static const char *mvcp_status_word( unit_status status )
+{
+	return mvcp_status_words[ ( unsigned )status < MVCP_STATUS_WORDS ? status : unit_unknown ].word;
+}
+
+/** Job outcome words indexed by their codes.
+*/
+
+static const char *mvcp_status_jobs[ ] = { "none", "ok", "failed" };
+
+#define MVCP_STATUS_JOBS ( int )( sizeof( mvcp_status_jobs ) / sizeof( mvcp_status_jobs[ 0 ] ) )
+
+/** Map a job outcome word to its code - unrecognised words leave the code
+	alone.
+*/
+
+static void mvcp_status_job_code( const char *word, int length, job_status *state )
+{
+	int index;
+
+	for ( index = 0; index < MVCP_STATUS_JOBS; index ++ )
+	{
+		if ( ( int )strlen( mvcp_status_jobs[ index ] ) == length && !memcmp( mvcp_status_jobs[ index ], word, length ) )
+		{
+			*state = ( job_status )index;
+			break;
+		}
+	}
+}
+
+/** Get the word used for a job outcome.
+*/
+
+static const char *mvcp_status_job_word( job_status state )
+{
+	return mvcp_status_jobs[ ( unsigned )state < MVCP_STATUS_JOBS ? state : job_none ];
+}
+
+/** Locate the value which starts at ptr. Clips are quoted and run up to a
+	quote followed by a separator, anything else runs up to the next
+	separator. Sets the value (without its quotes) and its length and returns
+	the position after it, or NULL if a quote isn't closed or the value is
+	empty.
+*/
+
+static char *mvcp_status_value( char *ptr, char **value, int *length )
+{
+	char *end = NULL;
+
+	if ( *ptr == '\"' )
+	{
+		end = ++ ptr;
+		while ( ( end = strchr( end, '\"' ) ) != NULL && end[ 1 ] != ' ' && end[ 1 ] != '\r' && end[ 1 ] != '\n' && end[ 1 ] != '\0' )
+			end ++;
+		if ( end == NULL )
+			return NULL;
+		*value = ptr;
+		*length = end - ptr;
+		return end + 1;
+	}
+
+	end = ptr + strcspn( ptr, " \r\n" );
+	*value = ptr;
+	*length = end - ptr;
+	return end == ptr ? NULL : end;
+}
+
+/** Apply a single field to a status - numeric values end at the following
+	separator and needn't be NUL terminated.
+*/
+
+static void mvcp_status_apply( mvcp_status status, int field, char *value, int length )
+{
+	switch( field )
+	{
+		case MVCP_STATUS_UNIT: status->unit = atoi( value ); break;
+		case MVCP_STATUS_MODE: mvcp_status_code( value, length, &status->status ); break;
+		case MVCP_STATUS_CLIP_NAME:
+		case MVCP_STATUS_TAIL_CLIP:
+		{
+			char *clip = field == MVCP_STATUS_CLIP_NAME ? status->clip : status->tail_clip;
+			if ( length >= MVCP_STATUS_CLIP )
+				length = MVCP_STATUS_CLIP - 1;
+			memcpy( clip, value, length );
+			clip[ length ] = '\0';
+			break;
+		}
+		case MVCP_STATUS_POSITION: status->position = atol( value ); break;
+		case MVCP_STATUS_SPEED: status->speed = atoi( value ); break;
+		case MVCP_STATUS_FPS: status->fps = atof( value ); break;
+		case MVCP_STATUS_IN: status->in = atol( value ); break;
+		case MVCP_STATUS_OUT: status->out = atol( value ); break;
+		case MVCP_STATUS_LENGTH: status->length = atol( value ); break;
+		case MVCP_STATUS_TAIL_POSITION: status->tail_position = atol( value ); break;
+		case MVCP_STATUS_TAIL_IN: status->tail_in = atol( value ); break;
+		case MVCP_STATUS_TAIL_OUT: status->tail_out = atol( value ); break;
+		case MVCP_STATUS_TAIL_LENGTH: status->tail_length = atol( value ); break;
+		case MVCP_STATUS_SEEK_FLAG: status->seek_flag = atoi( value ); break;
+		case MVCP_STATUS_GENERATION: status->generation = atoi( value ); break;
+		case MVCP_STATUS_CLIP_INDEX: status->clip_index = atoi( value ); break;
+		case MVCP_STATUS_JOB: status->job = atoi( value ); break;
+		case MVCP_STATUS_JOB_STATE: mvcp_status_job_code( value, length, &status->job_state ); break;
+	}
+}
+
+/** Parse a unit status string. The line is scanned in place in a single
+	pass - a line which doesn't hold exactly the expected fields leaves the
+	status zeroed.
 */
 
 void mvcp_status_parse( mvcp_status status, char *text )
 {
-	mvcp_tokeniser tokeniser = mvcp_tokeniser_init( );
-	if ( mvcp_tokeniser_parse_new( tokeniser, text, " " ) == 17 )
+	char *ptr = text;
+	char *value = NULL;
+	int length = 0;
+	int field;
+
+	for ( field = MVCP_STATUS_UNIT; field < MVCP_STATUS_FIELDS; field ++ )
 	{
-		status->unit = atoi( mvcp_tokeniser_get_string( tokeniser, 0 ) );
-		strncpy( status->clip, mvcp_util_strip( mvcp_tokeniser_get_string( tokeniser, 2 ), '\"' ), sizeof( status->clip ) );
-		status->position = atol( mvcp_tokeniser_get_string( tokeniser, 3 ) );
-		status->speed = atoi( mvcp_tokeniser_get_string( tokeniser, 4 ) );
-		status->fps = atof( mvcp_tokeniser_get_string( tokeniser, 5 ) );
-		status->in = atol( mvcp_tokeniser_get_string( tokeniser, 6 ) );
-		status->out = atol( mvcp_tokeniser_get_string( tokeniser, 7 ) );
-		status->length = atol( mvcp_tokeniser_get_string( tokeniser, 8 ) );
-
-		strncpy( status->tail_clip, mvcp_util_strip( mvcp_tokeniser_get_string( tokeniser, 9 ), '\"' ), sizeof( status->tail_clip ) );
-		status->tail_position = atol( mvcp_tokeniser_get_string( tokeniser, 10 ) );
-		status->tail_in = atol( mvcp_tokeniser_get_string( tokeniser, 11 ) );
-		status->tail_out = atol( mvcp_tokeniser_get_string( tokeniser, 12 ) );
-		status->tail_length = atol( mvcp_tokeniser_get_string( tokeniser, 13 ) );
-		status->seek_flag = atoi( mvcp_tokeniser_get_string( tokeniser, 14 ) );
-		status->generation = atoi( mvcp_tokeniser_get_string( tokeniser, 15 ) );
-		status->clip_index = atoi( mvcp_tokeniser_get_string( tokeniser, 16 ) );
-
-		if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "unknown" ) )
-			status->status = unit_unknown;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "undefined" ) )
-			status->status = unit_undefined;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "offline" ) )
-			status->status = unit_offline;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "not_loaded" ) )
-			status->status = unit_not_loaded;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "stopped" ) )
-			status->status = unit_stopped;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "paused" ) )
-			status->status = unit_paused;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "playing" ) )
-			status->status = unit_playing;
-		else if ( !strcmp( mvcp_tokeniser_get_string( tokeniser, 1 ), "disconnected" ) )
-			status->status = unit_disconnected;
+		if ( field != MVCP_STATUS_UNIT && *ptr ++ != ' ' )
+			break;
+		ptr = mvcp_status_value( ptr, &value, &length );
+		if ( ptr == NULL )
+			break;
+		mvcp_status_apply( status, field, value, length );
 	}
-	else
+
+	if ( field != MVCP_STATUS_FIELDS || ( *ptr != '\0' && *ptr != '\r' && *ptr != '\n' ) )
 	{
 		memset( status, 0, sizeof( mvcp_status_t ) );
 		fprintf( stderr, "Status thread changed?\n" );
 	}
-	mvcp_tokeniser_close( tokeniser );
+}
+
+/** Append count bytes of value to the text at offset, truncating to fit.
+	The last byte of the text is kept for the terminator. Returns the new
+	offset.
+*/
+
+static int mvcp_status_put( char *text, int length, int offset, const char *value, int count )
+{
+	if ( count > length - 1 - offset )
+		count = length - 1 - offset;
+	if ( count > 0 )
+	{
+		memcpy( text + offset, value, count );
+		offset += count;
+	}
+	return offset;
+}
+
+/** Append an integer preceded by a separator (none when 0).
+*/
+
+static int mvcp_status_put_int( char *text, int length, int offset, char separator, long value )
+{
+	char digits[ 24 ];
+	char *ptr = digits + sizeof( digits );
+	unsigned long magnitude = value < 0 ? - ( unsigned long )value : ( unsigned long )value;
+
+	do
+	{
+		*( -- ptr ) = '0' + magnitude % 10;
+		magnitude /= 10;
+	}
+	while ( magnitude != 0 );
+
+	if ( value < 0 )
+		*( -- ptr ) = '-';
+	if ( separator != 0 )
+		*( -- ptr ) = separator;
+
+	return mvcp_status_put( text, length, offset, ptr, digits + sizeof( digits ) - ptr );
+}
+
+/** Append a separator and a quoted clip.
+*/
+
+static int mvcp_status_put_clip( char *text, int length, int offset, const char *clip )
+{
+	offset = mvcp_status_put( text, length, offset, " \"", 2 );
+	offset = mvcp_status_put( text, length, offset, clip, strlen( clip ) );
+	return mvcp_status_put( text, length, offset, "\"", 1 );
+}
+
+/** Append a separator and the word for a status code.
+*/
+
+static int mvcp_status_put_word( char *text, int length, int offset, unit_status status )
+{
+	if ( ( unsigned )status >= MVCP_STATUS_WORDS )
+		status = unit_unknown;
+	offset = mvcp_status_put( text, length, offset, " ", 1 );
+	return mvcp_status_put( text, length, offset, mvcp_status_words[ status ].word, mvcp_status_words[ status ].length );
+}
+
+/** Append a separator and the frame rate to two decimal places.
+*/
+
+static int mvcp_status_put_fps( char *text, int length, int offset, double fps )
+{
+	char digits[ 32 ];
+	int count = snprintf( digits, sizeof( digits ), " %.2f", fps );
+	if ( count >= sizeof( digits ) )
+		count = sizeof( digits ) - 1;
+	return mvcp_status_put( text, length, offset, digits, count );
 }
 
 /** Serialise a status into a string.
@@ -84,61 +286,143 @@ void mvcp_status_parse( mvcp_status status, char *text )
 
 char *mvcp_status_serialise( mvcp_status status, char *text, int length )
 {
-	const char *status_string = NULL;
+	int offset = mvcp_status_put_int( text, length, 0, 0, status->unit );
 
-	switch( status->status )
-	{
-		case unit_undefined:
-			status_string = "undefined";
-			break;
+	offset = mvcp_status_put_word( text, length, offset, status->status );
+	offset = mvcp_status_put_clip( text, length, offset, status->clip );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->position );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->speed );
+	offset = mvcp_status_put_fps( text, length, offset, status->fps );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->in );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->out );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->length );
+	offset = mvcp_status_put_clip( text, length, offset, status->tail_clip );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->tail_position );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->tail_in );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->tail_out );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->tail_length );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->seek_flag );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->generation );
+	offset = mvcp_status_put_int( text, length, offset, ' ', status->clip_index );
+	offset = mvcp_status_put( text, length, offset, "\r\n", 2 );
 
-		case unit_offline:
-			status_string = "offline";
-			break;
+	if ( length > 0 )
+		text[ offset ] = '\0';
 
-		case unit_not_loaded:
-			status_string = "not_loaded";
-			break;
+	return text;
+}
 
-		case unit_stopped:
-			status_string = "stopped";
-			break;
+/** Determine if a status line is a delta line - the field after the unit
+	number of a delta is a field=value pair rather than a status word.
+*/
 
-		case unit_playing:
-			status_string = "playing";
-			break;
+int mvcp_status_is_delta( const char *text )
+{
+	const char *field = strchr( text, ' ' );
+	return field != NULL && strcspn( field + 1, " =" ) < strcspn( field + 1, " " );
+}
 
-		case unit_unknown:
-			status_string = "unknown";
-			break;
+/** Apply a delta line to the previous status of its unit. Fields which are
+	not mentioned are left as they are. Returns non-zero if the line is
+	malformed, in which case the status may have been partially updated.
+*/
 
-		case unit_paused:
-			status_string = "paused";
-			break;
+int mvcp_status_parse_delta( mvcp_status status, char *text )
+{
+	char *ptr = text;
+	char *value = NULL;
+	int length = 0;
+
+	status->unit = strtol( ptr, &ptr, 10 );
 
-		case unit_disconnected:
-			status_string = "disconnected";
+	while ( *ptr == ' ' )
+	{
+		int field = strtol( ptr + 1, &ptr, 10 );
+
+		if ( *ptr != '=' )
 			break;
+
+		ptr = mvcp_status_value( ptr + 1, &value, &length );
+		if ( ptr == NULL )
+			return 1;
+
+		if ( field != MVCP_STATUS_UNIT )
+			mvcp_status_apply( status, field, value, length );
 	}
 
-	snprintf( text, length, "%d %s \"%s\" %d %d %.2f %d %d %d \"%s\" %d %d %d %d %d %d %d\r\n",
-							status->unit,
-							status_string,
-							status->clip,
-							status->position, 
-							status->speed,
-							status->fps,
-							status->in,
-							status->out,
-							status->length,
-							status->tail_clip,
-							status->tail_position, 
-							status->tail_in,
-							status->tail_out,
-							status->tail_length,
-							status->seek_flag,
-							status->generation,
-							status->clip_index );
+	return *ptr != '\0' && *ptr != '\r' && *ptr != '\n';
+}
+
+/** Append a field=value pair to a delta line. Returns the new offset, which
+	is the length of the text once it has been truncated.
+*/
+
+static int mvcp_status_append( char *text, int length, int offset, int field, const char *format, ... )
+{
+	if ( offset < length )
+	{
+		va_list list;
+		offset += snprintf( text + offset, length - offset, " %d=", field );
+		if ( offset < length )
+		{
+			va_start( list, format );
+			offset += vsnprintf( text + offset, length - offset, format, list );
+			va_end( list );
+		}
+	}
+	return offset;
+}
+
+/** Serialise the fields of a record which differ from the previous record
+	of the unit as a delta line. The text is empty when nothing has changed.
+*/
+
+char *mvcp_status_record_delta( mvcp_status_record previous, mvcp_status_record record, char *text, int length )
+{
+	int offset = snprintf( text, length, "%d", record->unit );
+	int start = offset;
+
+	if ( record->status != previous->status )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_MODE, "%s", mvcp_status_word( record->status ) );
+	if ( record->clip != previous->clip )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_CLIP_NAME, "\"%s\"", mvcp_title_text( record->clip ) );
+	if ( record->position != previous->position )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_POSITION, "%d", record->position );
+	if ( record->speed != previous->speed )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_SPEED, "%d", record->speed );
+	if ( record->fps != previous->fps )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_FPS, "%.2f", record->fps );
+	if ( record->in != previous->in )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_IN, "%d", record->in );
+	if ( record->out != previous->out )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_OUT, "%d", record->out );
+	if ( record->length != previous->length )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_LENGTH, "%d", record->length );
+	if ( record->tail_clip != previous->tail_clip )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_TAIL_CLIP, "\"%s\"", mvcp_title_text( record->tail_clip ) );
+	if ( record->tail_position != previous->tail_position )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_TAIL_POSITION, "%d", record->tail_position );
+	if ( record->tail_in != previous->tail_in )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_TAIL_IN, "%d", record->tail_in );
+	if ( record->tail_out != previous->tail_out )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_TAIL_OUT, "%d", record->tail_out );
+	if ( record->tail_length != previous->tail_length )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_TAIL_LENGTH, "%d", record->tail_length );
+	if ( record->seek_flag != previous->seek_flag )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_SEEK_FLAG, "%d", record->seek_flag );
+	if ( record->generation != previous->generation )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_GENERATION, "%d", record->generation );
+	if ( record->clip_index != previous->clip_index )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_CLIP_INDEX, "%d", record->clip_index );
+	if ( record->job != previous->job )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_JOB, "%d", record->job );
+	if ( record->job_state != previous->job_state )
+		offset = mvcp_status_append( text, length, offset, MVCP_STATUS_JOB_STATE, "%s", mvcp_status_job_word( record->job_state ) );
+
+	if ( offset == start )
+		text[ 0 ] = '\0';
+	else if ( offset < length )
+		snprintf( text + offset, length - offset, "\r\n" );
 
 	return text;
 }
@@ -158,3 +442,152 @@ mvcp_status mvcp_status_copy( mvcp_status dest, mvcp_status src )
 {
 	return memcpy( dest, src, sizeof( mvcp_status_t ) );
 }
+
+/** Fill a record from a status.
+*/
+
+void mvcp_status_pack( mvcp_status_record record, mvcp_status status )
+{
+	mvcp_title clip = mvcp_title_intern( status->clip, sizeof( status->clip ) );
+	mvcp_title tail_clip = NULL;
+
+	/* The clips are almost always the same */
+	if ( clip != NULL && !strncmp( status->tail_clip, mvcp_title_text( clip ), sizeof( status->tail_clip ) ) )
+		tail_clip = mvcp_title_ref( clip );
+	else
+		tail_clip = mvcp_title_intern( status->tail_clip, sizeof( status->tail_clip ) );
+
+	mvcp_status_record_clear( record );
+	record->unit = status->unit;
+	record->status = status->status;
+	record->clip = clip;
+	record->position = status->position;
+	record->speed = status->speed;
+	record->fps = status->fps;
+	record->in = status->in;
+	record->out = status->out;
+	record->length = status->length;
+	record->tail_clip = tail_clip;
+	record->tail_position = status->tail_position;
+	record->tail_in = status->tail_in;
+	record->tail_out = status->tail_out;
+	record->tail_length = status->tail_length;
+	record->seek_flag = status->seek_flag;
+	record->generation = status->generation;
+	record->clip_index = status->clip_index;
+	record->job = status->job;
+	record->job_state = status->job_state;
+	record->dummy = status->dummy;
+}
+
+/** Fill a status from a record.
+*/
+
+void mvcp_status_unpack( mvcp_status status, mvcp_status_record record )
+{
+	memset( status, 0, sizeof( mvcp_status_t ) );
+	status->unit = record->unit;
+	status->status = record->status;
+	strncpy( status->clip, mvcp_title_text( record->clip ), sizeof( status->clip ) - 1 );
+	status->position = record->position;
+	status->speed = record->speed;
+	status->fps = record->fps;
+	status->in = record->in;
+	status->out = record->out;
+	status->length = record->length;
+	strncpy( status->tail_clip, mvcp_title_text( record->tail_clip ), sizeof( status->tail_clip ) - 1 );
+	status->tail_position = record->tail_position;
+	status->tail_in = record->tail_in;
+	status->tail_out = record->tail_out;
+	status->tail_length = record->tail_length;
+	status->seek_flag = record->seek_flag;
+	status->generation = record->generation;
+	status->clip_index = record->clip_index;
+	status->job = record->job;
+	status->job_state = record->job_state;
+	status->dummy = record->dummy;
+}
+
+/** Serialise a record into a string - gives the same text as the status.
+*/
+
+char *mvcp_status_record_serialise( mvcp_status_record record, char *text, int length )
+{
+	int offset = mvcp_status_put_int( text, length, 0, 0, record->unit );
+
+	offset = mvcp_status_put_word( text, length, offset, record->status );
+	offset = mvcp_status_put_clip( text, length, offset, mvcp_title_text( record->clip ) );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->position );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->speed );
+	offset = mvcp_status_put_fps( text, length, offset, record->fps );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->in );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->out );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->length );
+	offset = mvcp_status_put_clip( text, length, offset, mvcp_title_text( record->tail_clip ) );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->tail_position );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->tail_in );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->tail_out );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->tail_length );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->seek_flag );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->generation );
+	offset = mvcp_status_put_int( text, length, offset, ' ', record->clip_index );
+	offset = mvcp_status_put( text, length, offset, "\r\n", 2 );
+
+	if ( length > 0 )
+		text[ offset ] = '\0';
+
+	return text;
+}
+
+/** Compare two records for changes - interned titles with the same text are
+	the same title, so the clips compare by reference.
+*/
+
+int mvcp_status_record_compare( mvcp_status_record record1, mvcp_status_record record2 )
+{
+	return record1->unit != record2->unit ||
+		   record1->status != record2->status ||
+		   record1->clip != record2->clip ||
+		   record1->position != record2->position ||
+		   record1->speed != record2->speed ||
+		   record1->fps != record2->fps ||
+		   record1->in != record2->in ||
+		   record1->out != record2->out ||
+		   record1->length != record2->length ||
+		   record1->tail_clip != record2->tail_clip ||
+		   record1->tail_position != record2->tail_position ||
+		   record1->tail_in != record2->tail_in ||
+		   record1->tail_out != record2->tail_out ||
+		   record1->tail_length != record2->tail_length ||
+		   record1->seek_flag != record2->seek_flag ||
+		   record1->generation != record2->generation ||
+		   record1->clip_index != record2->clip_index ||
+		   record1->job != record2->job ||
+		   record1->job_state != record2->job_state ||
+		   record1->dummy != record2->dummy;
+}
+
+/** Copy a record from src to dest, taking references to the titles.
+*/
+
+mvcp_status_record mvcp_status_record_copy( mvcp_status_record dest, mvcp_status_record src )
+{
+	if ( dest != src )
+	{
+		mvcp_title_ref( src->clip );
+		mvcp_title_ref( src->tail_clip );
+		mvcp_status_record_clear( dest );
+		*dest = *src;
+	}
+	return dest;
+}
+
+/** Release the titles held by a record and empty it.
+*/
+
+void mvcp_status_record_clear( mvcp_status_record record )
+{
+	mvcp_title_release( record->clip );
+	mvcp_title_release( record->tail_clip );
+	memset( record, 0, sizeof( mvcp_status_record_t ) );
+}
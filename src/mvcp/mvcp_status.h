@@ -23,6 +23,9 @@
 
 #include <stdint.h>
 
+/* Application header files */
+#include "mvcp_title.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -44,6 +47,51 @@ typedef enum
 }
 unit_status;
 
+/** Outcomes of asynchronous jobs.
+*/
+
+typedef enum
+{
+	job_none = 0,
+	job_ok,
+	job_failed
+}
+job_status;
+
+/** Fields of a status line, as numbered in delta lines. The job fields
+	follow the fields of a full line and are only ever sent in delta lines.
+*/
+
+typedef enum
+{
+	MVCP_STATUS_UNIT = 0,
+	MVCP_STATUS_MODE,
+	MVCP_STATUS_CLIP_NAME,
+	MVCP_STATUS_POSITION,
+	MVCP_STATUS_SPEED,
+	MVCP_STATUS_FPS,
+	MVCP_STATUS_IN,
+	MVCP_STATUS_OUT,
+	MVCP_STATUS_LENGTH,
+	MVCP_STATUS_TAIL_CLIP,
+	MVCP_STATUS_TAIL_POSITION,
+	MVCP_STATUS_TAIL_IN,
+	MVCP_STATUS_TAIL_OUT,
+	MVCP_STATUS_TAIL_LENGTH,
+	MVCP_STATUS_SEEK_FLAG,
+	MVCP_STATUS_GENERATION,
+	MVCP_STATUS_CLIP_INDEX,
+	MVCP_STATUS_FIELDS,
+	MVCP_STATUS_JOB = MVCP_STATUS_FIELDS,
+	MVCP_STATUS_JOB_STATE
+}
+mvcp_status_field;
+
+/** Size of the clip strings in the status structure.
+*/
+
+#define MVCP_STATUS_CLIP 2048
+
 /** Status structure.
 */
 
@@ -51,14 +99,14 @@ typedef struct
 {
 	int unit;
 	unit_status status;
-	char clip[ 2048 ];
+	char clip[ MVCP_STATUS_CLIP ];
 	int32_t position;
 	int speed;
 	double fps;
 	int32_t in;
 	int32_t out;
 	int32_t length;
-	char tail_clip[ 2048 ];
+	char tail_clip[ MVCP_STATUS_CLIP ];
 	int32_t tail_position;
 	int32_t tail_in;
 	int32_t tail_out;
@@ -66,17 +114,58 @@ typedef struct
 	int seek_flag;
 	int generation;
 	int clip_index;
+	int job;
+	job_status job_state;
 	int dummy;
 }
 *mvcp_status, mvcp_status_t;
 
+/** Compact status record - the same information as the status structure
+	with the clips held as interned titles. Records must be zeroed before
+	first use and cleared when done with.
+*/
+
+typedef struct
+{
+	int unit;
+	unit_status status;
+	mvcp_title clip;
+	int32_t position;
+	int speed;
+	double fps;
+	int32_t in;
+	int32_t out;
+	int32_t length;
+	mvcp_title tail_clip;
+	int32_t tail_position;
+	int32_t tail_in;
+	int32_t tail_out;
+	int32_t tail_length;
+	int seek_flag;
+	int generation;
+	int clip_index;
+	int job;
+	job_status job_state;
+	int dummy;
+}
+*mvcp_status_record, mvcp_status_record_t;
+
 /** MVCP Status API
 */
 
 extern void mvcp_status_parse( mvcp_status, char * );
 extern char *mvcp_status_serialise( mvcp_status, char *, int );
+extern int mvcp_status_is_delta( const char * );
+extern int mvcp_status_parse_delta( mvcp_status, char * );
 extern int mvcp_status_compare( mvcp_status, mvcp_status );
 extern mvcp_status mvcp_status_copy( mvcp_status, mvcp_status );
+extern void mvcp_status_pack( mvcp_status_record, mvcp_status );
+extern void mvcp_status_unpack( mvcp_status, mvcp_status_record );
+extern char *mvcp_status_record_serialise( mvcp_status_record, char *, int );
+extern char *mvcp_status_record_delta( mvcp_status_record, mvcp_status_record, char *, int );
+extern int mvcp_status_record_compare( mvcp_status_record, mvcp_status_record );
+extern mvcp_status_record mvcp_status_record_copy( mvcp_status_record, mvcp_status_record );
+extern void mvcp_status_record_clear( mvcp_status_record );
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,189 @@
+/*
+ * mvcp_title.c -- Interned Clip Titles
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* System header files */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Application header files */
+#include "mvcp_title.h"
+
+/** Number of hash buckets (a power of 2).
+*/
+
+#define MVCP_TITLE_BUCKETS 256
+
+/** The process wide title table. The lock is held for reading while titles
+	are looked up and for writing while they are added or removed, so a title
+	is never freed while a reader might still be looking at it.
+*/
+
+static struct
+{
+	pthread_rwlock_t lock;
+	mvcp_title buckets[ MVCP_TITLE_BUCKETS ];
+}
+titles = { PTHREAD_RWLOCK_INITIALIZER };
+
+static unsigned int mvcp_title_hash( const char *text, int length )
+{
+	unsigned int hash = 2166136261u;
+	while ( length -- )
+		hash = ( hash ^ ( unsigned char )*text ++ ) * 16777619u;
+	return hash;
+}
+
+/** Find a live title - must be called with the lock held.
+*/
+
+static mvcp_title mvcp_title_find( const char *text, int length, unsigned int hash )
+{
+	mvcp_title title = titles.buckets[ hash & ( MVCP_TITLE_BUCKETS - 1 ) ];
+	for ( ; title != NULL; title = title->next )
+		if ( title->hash == hash && title->length == length && !memcmp( title->text, text, length ) && mvcp_title_try_ref( title ) )
+			break;
+	return title;
+}
+
+/** Obtain a reference to the title with the given text, truncated to at most
+	max characters when max is not negative. An empty or missing text gives
+	NULL, which all the title functions accept.
+*/
+
+mvcp_title mvcp_title_intern( const char *text, int max )
+{
+	mvcp_title title = NULL;
+
+	const char *end = text == NULL || max < 0 ? NULL : memchr( text, '\0', max );
+	int length = text == NULL ? 0 : max < 0 ? strlen( text ) : end != NULL ? end - text : max;
+
+	if ( length > 0 )
+	{
+		unsigned int hash = mvcp_title_hash( text, length );
+
+		pthread_rwlock_rdlock( &titles.lock );
+		title = mvcp_title_find( text, length, hash );
+		pthread_rwlock_unlock( &titles.lock );
+
+		if ( title == NULL )
+		{
+			pthread_rwlock_wrlock( &titles.lock );
+			title = mvcp_title_find( text, length, hash );
+			if ( title == NULL )
+			{
+				title = malloc( sizeof( mvcp_title_t ) + length );
+				if ( title != NULL )
+				{
+					mvcp_title *bucket = &titles.buckets[ hash & ( MVCP_TITLE_BUCKETS - 1 ) ];
+					title->refs = 1;
+					title->hash = hash;
+					title->length = length;
+					memcpy( title->text, text, length );
+					title->text[ length ] = '\0';
+					title->next = *bucket;
+					*bucket = title;
+				}
+			}
+			pthread_rwlock_unlock( &titles.lock );
+		}
+	}
+
+	return title;
+}
+
+/** Obtain another reference to a title the caller already holds.
+*/
+
+mvcp_title mvcp_title_ref( mvcp_title title )
+{
+	if ( title != NULL )
+		__sync_fetch_and_add( &title->refs, 1 );
+	return title;
+}
+
+/** Obtain a reference to a title which the caller doesn't hold a reference
+	to - the read lock must be held. Fails when the title is being released,
+	as a title is never brought back once its last reference has gone.
+*/
+
+int mvcp_title_try_ref( mvcp_title title )
+{
+	if ( title != NULL )
+	{
+		int refs = title->refs;
+		while ( refs > 0 )
+		{
+			int previous = __sync_val_compare_and_swap( &title->refs, refs, refs + 1 );
+			if ( previous == refs )
+				return 1;
+			refs = previous;
+		}
+		return 0;
+	}
+	return 1;
+}
+
+/** Release a reference, freeing the title with the last one.
+*/
+
+void mvcp_title_release( mvcp_title title )
+{
+	if ( title != NULL && __sync_sub_and_fetch( &title->refs, 1 ) == 0 )
+	{
+		mvcp_title *entry = &titles.buckets[ title->hash & ( MVCP_TITLE_BUCKETS - 1 ) ];
+		pthread_rwlock_wrlock( &titles.lock );
+		while ( *entry != NULL && *entry != title )
+			entry = &( *entry )->next;
+		if ( *entry != NULL )
+			*entry = title->next;
+		pthread_rwlock_unlock( &titles.lock );
+		free( title );
+	}
+}
+
+/** Get the text of the title.
+*/
+
+const char *mvcp_title_text( mvcp_title title )
+{
+	return title != NULL ? title->text : "";
+}
+
+/** Get the length of the title.
+*/
+
+int mvcp_title_length( mvcp_title title )
+{
+	return title != NULL ? title->length : 0;
+}
+
+/** Hold off the release of titles while references are taken with
+	mvcp_title_try_ref.
+*/
+
+void mvcp_title_read_lock( )
+{
+	pthread_rwlock_rdlock( &titles.lock );
+}
+
+void mvcp_title_read_unlock( )
+{
+	pthread_rwlock_unlock( &titles.lock );
+}
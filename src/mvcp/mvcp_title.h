@@ -0,0 +1,58 @@
+/*
+ * mvcp_title.h -- Interned Clip Titles
+ * Copyright (C) 2002-2015 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _MVCP_TITLE_H_
+#define _MVCP_TITLE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** An interned, reference counted title. Titles with the same text share
+	a single instance while any reference to it remains.
+*/
+
+typedef struct mvcp_title_s
+{
+	struct mvcp_title_s *next;
+	volatile int refs;
+	unsigned int hash;
+	int length;
+	char text[ 1 ];
+}
+*mvcp_title, mvcp_title_t;
+
+/** Title API.
+*/
+
+extern mvcp_title mvcp_title_intern( const char *, int );
+extern mvcp_title mvcp_title_ref( mvcp_title );
+extern int mvcp_title_try_ref( mvcp_title );
+extern void mvcp_title_release( mvcp_title );
+extern const char *mvcp_title_text( mvcp_title );
+extern int mvcp_title_length( mvcp_title );
+extern void mvcp_title_read_lock( );
+extern void mvcp_title_read_unlock( );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,105 +32,196 @@ mvcp_tokeniser mvcp_tokeniser_init( )
 {
 	mvcp_tokeniser tokeniser = malloc( sizeof( mvcp_tokeniser_t ) );
 	if ( tokeniser != NULL )
+	{
 		memset( tokeniser, 0, sizeof( mvcp_tokeniser_t ) );
+		tokeniser->buffer = tokeniser->local_buffer;
+		tokeniser->buffer_size = MVCP_TOKENISER_BUFFER;
+		tokeniser->spans = tokeniser->local_spans;
+		tokeniser->spans_size = MVCP_TOKENISER_TOKENS;
+		tokeniser->tokens = tokeniser->local_tokens;
+		tokeniser->size = MVCP_TOKENISER_TOKENS;
+	}
 	return tokeniser;
 }
 
-/** Clear the tokeniser.
+/** Grow one of the tokeniser arrays, moving it off the local storage if needed.
 */
 
-static void mvcp_tokeniser_clear( mvcp_tokeniser tokeniser )
+static void *mvcp_tokeniser_grow( void *array, void *local, int used, int size )
 {
-	int index = 0;
-	for ( index = 0; index < tokeniser->count; index ++ )
-		free( tokeniser->tokens[ index ] );
-	tokeniser->count = 0;
-	free( tokeniser->input );
-	tokeniser->input = NULL;
+	void *result = NULL;
+	if ( array != local )
+	{
+		result = realloc( array, size );
+	}
+	else
+	{
+		result = malloc( size );
+		if ( result != NULL )
+			memcpy( result, array, used );
+	}
+	return result;
 }
 
-/** Append a string to the tokeniser.
+/** Append a span to the tokeniser.
 */
 
-static int mvcp_tokeniser_append( mvcp_tokeniser tokeniser, char *token )
+static int mvcp_tokeniser_append( mvcp_tokeniser tokeniser, char *start, int length )
 {
-	int error = 0;
-
-	if ( tokeniser->count == tokeniser->size )
+	if ( tokeniser->count == tokeniser->spans_size )
 	{
-		tokeniser->size += 20;
-		tokeniser->tokens = realloc( tokeniser->tokens, tokeniser->size * sizeof( char * ) );
+		int size = tokeniser->spans_size * 2;
+		mvcp_span spans = mvcp_tokeniser_grow( tokeniser->spans, tokeniser->local_spans, tokeniser->count * sizeof( mvcp_span_t ), size * sizeof( mvcp_span_t ) );
+		if ( spans == NULL )
+			return -1;
+		tokeniser->spans = spans;
+		tokeniser->spans_size = size;
 	}
+	tokeniser->spans[ tokeniser->count ].start = start;
+	tokeniser->spans[ tokeniser->count ++ ].length = length;
+	return 0;
+}
 
-	if ( tokeniser->tokens != NULL )
-	{
-		tokeniser->tokens[ tokeniser->count ++ ] = strdup( token );
-	}
-	else
+/** Locate the next delimiter at or after index, returning -1 if there is none.
+*/
+
+static int mvcp_tokeniser_find( const char *string, int length, int index, const char *delimiter, int delimiter_size )
+{
+	if ( delimiter_size == 1 )
 	{
-		tokeniser->count = 0;
-		error = -1;
+		const char *end = memchr( string + index, delimiter[ 0 ], length - index );
+		return end != NULL ? end - string : -1;
 	}
-	return error;
+	for ( ; index + delimiter_size <= length; index ++ )
+		if ( string[ index ] == delimiter[ 0 ] && !memcmp( string + index, delimiter, delimiter_size ) )
+			return index;
+	return -1;
 }
 
-/** Parse a string by splitting on the delimiter provided.
+/** Split length characters of string on the delimiter without copying anything.
+
+	The spans obtained via mvcp_tokeniser_get_span refer to the string itself
+	and are not NUL terminated. A token which opens with a double quote runs
+	up to a delimiter preceded by a closing quote (the quotes are kept). The
+	return value is that of mvcp_tokeniser_parse_new.
 */
 
-int mvcp_tokeniser_parse_new( mvcp_tokeniser tokeniser, char *string, const char *delimiter )
+int mvcp_tokeniser_split( mvcp_tokeniser tokeniser, char *string, int length, const char *delimiter )
 {
 	int count = 0;
-	int length = strlen( string );
 	int delimiter_size = strlen( delimiter );
 	int index = 0;
-	char *token = strdup( string );
+	int token = -1;
+	int empty = 1;
 
-	mvcp_tokeniser_clear( tokeniser );
-	tokeniser->input = strdup( string );
-	strcpy( token, "" );
+	tokeniser->count = 0;
+	tokeniser->strings = 0;
 
-	for ( index = 0; index < length; )
+	while ( index < length )
 	{
-		char *start = string + index;
-		char *end = strstr( start, delimiter );
+		int end = mvcp_tokeniser_find( string, length, index, delimiter, delimiter_size );
+
+		if ( token == -1 )
+			token = index;
 
-		if ( end == NULL )
+		if ( end == -1 )
 		{
-			strcat( token, start );
-			mvcp_tokeniser_append( tokeniser, token );
+			mvcp_tokeniser_append( tokeniser, string + token, length - token );
 			index = length;
+			empty = 0;
 			count ++;
 		}
-		else if ( start != end )
+		else if ( end != index )
 		{
-			strncat( token, start, end - start );
-			index += end - start;
-			if ( token[ 0 ] != '\"' || ( token[ 0 ] == '\"' && token[ strlen( token ) - 1 ] == '\"' ) )
+			index = end;
+			if ( string[ token ] != '\"' || string[ end - 1 ] == '\"' )
 			{
-				mvcp_tokeniser_append( tokeniser, token );
-				strcpy( token, "" );
+				mvcp_tokeniser_append( tokeniser, string + token, end - token );
+				token = -1;
+				empty = 1;
 				count ++;
 			}
-			else while ( strncmp( string + index, delimiter, delimiter_size ) == 0 )
+			else 
 			{
-				strncat( token, delimiter, delimiter_size );
-				index += delimiter_size;
+				empty = 0;
+				while ( index + delimiter_size <= length && !memcmp( string + index, delimiter, delimiter_size ) )
+					index += delimiter_size;
 			}
 		}
 		else
 		{
-			index += strlen( delimiter );
+			if ( token == index )
+				token = -1;
+			index += delimiter_size;
 		}
 	}
 
 	/* Special case - malformed string condition */
-	if ( !strcmp( token, "" ) )
+	if ( empty )
 	{
 		count = 0 - ( count - 1 );
-		mvcp_tokeniser_append( tokeniser, token );
+		mvcp_tokeniser_append( tokeniser, string + length, 0 );
 	}
-		
-	free( token );
+
+	return count;
+}
+
+/** Parse a string by splitting on the delimiter provided.
+
+	The input and the tokens are held in a buffer which is reused by later
+	calls, so the returned strings are only valid until the next parse.
+*/
+
+int mvcp_tokeniser_parse_new( mvcp_tokeniser tokeniser, char *string, const char *delimiter )
+{
+	int count = 0;
+	int length = strlen( string );
+	int index = 0;
+	char *work = NULL;
+
+	if ( tokeniser->buffer_size < 2 * ( length + 1 ) )
+	{
+		int size = 2 * ( length + 1 );
+		char *buffer = mvcp_tokeniser_grow( tokeniser->buffer, tokeniser->local_buffer, 0, size );
+		if ( buffer == NULL )
+		{
+			tokeniser->count = tokeniser->strings = 0;
+			return 0;
+		}
+		tokeniser->buffer = buffer;
+		tokeniser->buffer_size = size;
+	}
+
+	/* The input is kept intact and a second copy is cut up into the tokens */
+	tokeniser->input = tokeniser->buffer;
+	work = tokeniser->buffer + length + 1;
+	memcpy( tokeniser->input, string, length + 1 );
+	memcpy( work, string, length + 1 );
+
+	count = mvcp_tokeniser_split( tokeniser, tokeniser->input, length, delimiter );
+
+	if ( tokeniser->count > tokeniser->size )
+	{
+		int size = tokeniser->count * 2;
+		char **tokens = mvcp_tokeniser_grow( tokeniser->tokens, tokeniser->local_tokens, 0, size * sizeof( char * ) );
+		if ( tokens == NULL )
+		{
+			tokeniser->count = 0;
+			return 0;
+		}
+		tokeniser->tokens = tokens;
+		tokeniser->size = size;
+	}
+
+	for ( index = 0; index < tokeniser->count; index ++ )
+	{
+		mvcp_span span = &tokeniser->spans[ index ];
+		char *token = work + ( span->start - tokeniser->input );
+		token[ span->length ] = '\0';
+		tokeniser->tokens[ index ] = token;
+	}
+	tokeniser->strings = tokeniser->count;
+
 	return count;
 }
 
@@ -155,18 +246,33 @@ int mvcp_tokeniser_count( mvcp_tokeniser tokeniser )
 
 char *mvcp_tokeniser_get_string( mvcp_tokeniser tokeniser, int index )
 {
-	if ( index < tokeniser->count )
+	if ( index < tokeniser->strings )
 		return tokeniser->tokens[ index ];
 	else
 		return NULL;
 }
 
+/** Get a token as a span of the string that was split.
+*/
+
+mvcp_span mvcp_tokeniser_get_span( mvcp_tokeniser tokeniser, int index )
+{
+	if ( index < tokeniser->count )
+		return &tokeniser->spans[ index ];
+	else
+		return NULL;
+}
+
 /** Close the tokeniser.
 */
 
 void mvcp_tokeniser_close( mvcp_tokeniser tokeniser )
 {
-	mvcp_tokeniser_clear( tokeniser );
-	free( tokeniser->tokens );
+	if ( tokeniser->buffer != tokeniser->local_buffer )
+		free( tokeniser->buffer );
+	if ( tokeniser->spans != tokeniser->local_spans )
+		free( tokeniser->spans );
+	if ( tokeniser->tokens != tokeniser->local_tokens )
+		free( tokeniser->tokens );
 	free( tokeniser );
 }
@@ -26,6 +26,23 @@ extern "C"
 {
 #endif
 
+/** A token as a position and length within the string that was split.
+*/
+
+typedef struct
+{
+	char *start;
+	int length;
+}
+*mvcp_span, mvcp_span_t;
+
+/** Storage held in the tokeniser itself - typical command and status lines
+	need nothing more.
+*/
+
+#define MVCP_TOKENISER_BUFFER 512
+#define MVCP_TOKENISER_TOKENS 24
+
 /** Structure for tokeniser.
 */
 
@@ -35,6 +52,14 @@ typedef struct
 	char **tokens;
 	int count;
 	int size;
+	int strings;
+	mvcp_span spans;
+	int spans_size;
+	char *buffer;
+	int buffer_size;
+	char local_buffer[ MVCP_TOKENISER_BUFFER ];
+	mvcp_span_t local_spans[ MVCP_TOKENISER_TOKENS ];
+	char *local_tokens[ MVCP_TOKENISER_TOKENS ];
 }
 *mvcp_tokeniser, mvcp_tokeniser_t;
 
@@ -43,6 +68,8 @@ typedef struct
 
 extern mvcp_tokeniser mvcp_tokeniser_init( );
 extern int mvcp_tokeniser_parse_new( mvcp_tokeniser, char *, const char * );
+extern int mvcp_tokeniser_split( mvcp_tokeniser, char *, int, const char * );
+extern mvcp_span mvcp_tokeniser_get_span( mvcp_tokeniser, int );
 extern char *mvcp_tokeniser_get_input( mvcp_tokeniser );
 extern int mvcp_tokeniser_count( mvcp_tokeniser );
 extern char *mvcp_tokeniser_get_string( mvcp_tokeniser, int );